@@ -11,15 +11,17 @@ enum TokenType {
     EndOfText,
     OpenParenthesis,
     ClosedParenthesis,
-    Number
+    Number,
+    Identifier
 };
 
 struct Token {
     TokenType    Type;
     double       Value;
     char         Symbol;
+    unsigned     Slot;
 
-    Token():Type(Error), Value(0), Symbol(0)
+    Token():Type(Error), Value(0), Symbol(0), Slot(0)
     {}
 };
 
@@ -30,13 +32,18 @@ enum ASTNodeType {
     OperatorMul,
     OperatorDiv,
     UnaryMinus,
-    NumberValue
+    NumberValue,
+    Variable
 };
 
 class ASTNode
 {
 public:
     ASTNodeType Type;
+    union {
+        unsigned Slot;      // Variable only: index into the value slots
+        unsigned Size;      // operators: the nodes in the subtree, or 0
+    };
     double      Value;
     ASTNode*    Left;
     ASTNode*    Right;
@@ -44,14 +51,75 @@ public:
     ASTNode()
     {
         Type = Undefined;
+        Slot = 0;
         Value = 0;
         Left = NULL;
         Right = NULL;
     }
 
+    // The nodes in the subtree at 'node': 1 for a leaf; for an operator,
+    // its Size, which the parser counts and the Optimizer does not update,
+    // so it is only an estimate after that.
+    static unsigned SubtreeSize(const ASTNode* node)
+    {
+        if(node == NULL)
+            return 0;
+        if(node->Type == NumberValue || node->Type == Variable)
+            return 1;
+
+        return node->Size;
+    }
+
+    // Size from the sizes of the children, at most 2^32 - 1.
+    void CountSize()
+    {
+        unsigned long long size = 1ULL + SubtreeSize(Left) + SubtreeSize(Right);
+        Size = size > 0xFFFFFFFFULL ? 0xFFFFFFFFu : (unsigned)size;
+    }
+
     ~ASTNode()
     {
-        delete Left;
-        delete Right;
+        if(Left != NULL)
+            Release(Left, 1);
+        if(Right != NULL)
+            Release(Right, 1);
+    }
+
+private:
+    enum { MaxRecursion = 1024 };
+
+    // Note: Deleting the children recursively needs as many native stack
+    //       frames as the tree is deep, so that is only done for the first
+    //       MaxRecursion levels. Below them, the subtree is rotated to the
+    //       right until the node at hand has no left child; then it is
+    //       unlinked and deleted with no children left, and we go on with
+    //       its right child. Every rotation moves one node off the left
+    //       spine for good, so this takes linear time and no extra memory.
+    static void Release(ASTNode* node, size_t depth)
+    {
+        if(depth < MaxRecursion) {
+            if(node->Left != NULL)
+                Release(node->Left, depth + 1);
+            if(node->Right != NULL)
+                Release(node->Right, depth + 1);
+            node->Left = node->Right = NULL;
+            delete node;
+            return;
+        }
+
+        while(node != NULL) {
+            if(node->Left != NULL) {
+                ASTNode* left = node->Left;
+                node->Left = left->Right;
+                left->Right = node;
+                node = left;
+            }
+            else {
+                ASTNode* right = node->Right;
+                node->Right = NULL;
+                delete node;
+                node = right;
+            }
+        }
     }
 };
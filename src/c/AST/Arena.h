@@ -0,0 +1,156 @@
+/*
+ * Arena.h - A bump-pointer arena from which the parser allocates its nodes.
+ *
+ * Note: Allocating every ASTNode with 'new', and then freeing the whole tree
+ *       again with a recursive 'delete', means one malloc/free pair per node.
+ *       An arena instead hands out memory from large blocks by simply
+ *       advancing a pointer, and gives it all back at once:
+ *
+ *        -----------------------------------------
+ *       |node|node|node|node|     free ...        |   <- m_Ptr ... m_End
+ *        -----------------------------------------
+ *
+ *       Reset()   rewinds to the first block, keeping the blocks for reuse
+ *                 (the mode for long-lived parser objects).
+ *       Release() hands all blocks back to the system.
+ *
+ *       Neither calls any destructor, so a tree allocated in an arena must
+ *       *not* be deleted; it simply goes away with the next Reset() or
+ *       Release().
+ */
+
+#ifndef ARENA_H
+#  define ARENA_H 1
+#endif
+
+#include <stdlib.h>
+#include <new>
+
+class NodeArena
+{
+    struct Block {
+        Block* Next;
+        size_t Size;        // usable bytes following the header
+    };
+
+    enum { Alignment = 16 };
+
+    Block*  m_First;
+    Block*  m_Current;
+    char*   m_Ptr;
+    char*   m_End;
+    size_t  m_BlockSize;
+    size_t  m_Reserved;     // total payload bytes of all blocks
+
+    static size_t HeaderSize()
+    {
+        return (sizeof(Block) + Alignment - 1) & ~(size_t)(Alignment - 1);
+    }
+
+    static char* Payload(Block* block)
+    {
+        return (char*)block + HeaderSize();
+    }
+
+    void Enter(Block* block)
+    {
+        m_Current = block;
+        m_Ptr = Payload(block);
+        m_End = m_Ptr + block->Size;
+    }
+
+    void* AllocateSlow(size_t size)
+    {
+        // Reuse the blocks kept by Reset() first, then grow.
+        while(m_Current != NULL && m_Current->Next != NULL) {
+            Enter(m_Current->Next);
+            if(size <= (size_t)(m_End - m_Ptr)) {
+                void* p = m_Ptr;
+                m_Ptr += size;
+                return p;
+            }
+        }
+
+        size_t payload = size > m_BlockSize ? size : m_BlockSize;
+        Block* block = (Block*)malloc(HeaderSize() + payload);
+        if(block == NULL)
+            throw std::bad_alloc();
+
+        block->Next = NULL;
+        block->Size = payload;
+        m_Reserved += payload;
+
+        if(m_Current == NULL)
+            m_First = block;
+        else
+            m_Current->Next = block;
+
+        Enter(block);
+        void* p = m_Ptr;
+        m_Ptr += size;
+        return p;
+    }
+
+    // Not copyable: the blocks are owned.
+    NodeArena(const NodeArena&);
+    NodeArena& operator=(const NodeArena&);
+
+public:
+    NodeArena(size_t blockSize = 64 * 1024):
+        m_First(NULL), m_Current(NULL), m_Ptr(NULL), m_End(NULL),
+        m_BlockSize(blockSize), m_Reserved(0)
+    {
+    }
+
+    ~NodeArena()
+    {
+        Release();
+    }
+
+    void* Allocate(size_t size)
+    {
+        size = (size + Alignment - 1) & ~(size_t)(Alignment - 1);
+
+        if(size <= (size_t)(m_End - m_Ptr)) {
+            void* p = m_Ptr;
+            m_Ptr += size;
+            return p;
+        }
+
+        return AllocateSlow(size);
+    }
+
+    template<class T>
+    T* Create()
+    {
+        return new(Allocate(sizeof(T))) T;
+    }
+
+    // Forget everything allocated so far, but keep the memory.
+    void Reset()
+    {
+        if(m_First != NULL)
+            Enter(m_First);
+    }
+
+    // Forget everything allocated so far and free the memory.
+    void Release()
+    {
+        Block* block = m_First;
+        while(block != NULL) {
+            Block* next = block->Next;
+            free(block);
+            block = next;
+        }
+
+        m_First = m_Current = NULL;
+        m_Ptr = m_End = NULL;
+        m_Reserved = 0;
+    }
+
+    // Bytes currently held from the system (not bytes in use).
+    size_t Reserved() const
+    {
+        return m_Reserved;
+    }
+};
@@ -0,0 +1,412 @@
+/*
+ * BatchEvaluator.h - Evaluates one expression over many rows of inputs.
+ *
+ * Note: Calling Evaluator::Evaluate once per row walks the whole tree for
+ *       every row. Here the rows are processed in blocks of BlockSize,
+ *       and the expression is walked once per block, node by node, in
+ *       postfix order: each node turns the columns of its children into
+ *       its own column of BlockSize values, with one tight vector loop.
+ *
+ *       The inputs are columnar, i.e. 'columns[slot]' points at the 'rows'
+ *       values of the variable in that slot, and the result goes to an
+ *       output column of 'rows' values:
+ *
+ *        SymbolTable symbols;
+ *        PostfixExpression expr;
+ *        PostfixParser(&expr, &symbols).Parse("x*x + 2*y");
+ *
+ *        const double* columns[] = { xs, ys };   // in slot order
+ *        BatchEvaluator().Evaluate(expr, columns, rows, results);
+ *
+ *       The loops for + - * / and unary minus come in AVX-512, AVX2 and
+ *       plain C++ versions; the best one the CPU supports is picked at run
+ *       time. All of them do the same IEEE operations as the Evaluator, so
+ *       the results agree bit for bit.
+ */
+
+#ifndef BATCHEVALUATOR_H
+#  define BATCHEVALUATOR_H 1
+#endif
+
+#include <map>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef EVALUATOR_H
+#  include "Evaluator.h"
+#endif
+
+#ifndef DAG_H
+#  include "Dag.h"
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define EVALEXP_X86_KERNELS 1
+#  include <immintrin.h>
+#endif
+
+// One set of column loops: r[i] = a[i] op b[i], for i < n.
+struct BatchKernels {
+    const char* Name;
+    void (*Add)(const double* a, const double* b, double* r, size_t n);
+    void (*Sub)(const double* a, const double* b, double* r, size_t n);
+    void (*Mul)(const double* a, const double* b, double* r, size_t n);
+    void (*Div)(const double* a, const double* b, double* r, size_t n);
+    void (*Neg)(const double* a, const double* b, double* r, size_t n);
+};
+
+#define EVALEXP_SCALAR_KERNEL(name, expr)                                   \
+    static void name(const double* a, const double* b, double* r, size_t n) \
+    {                                                                       \
+        (void)b;                                                            \
+        for(size_t i = 0; i < n; i++)                                       \
+            r[i] = expr;                                                    \
+    }
+
+struct ScalarKernels {
+    EVALEXP_SCALAR_KERNEL(Add, a[i] + b[i])
+    EVALEXP_SCALAR_KERNEL(Sub, a[i] - b[i])
+    EVALEXP_SCALAR_KERNEL(Mul, a[i] * b[i])
+    EVALEXP_SCALAR_KERNEL(Div, a[i] / b[i])
+    EVALEXP_SCALAR_KERNEL(Neg, -a[i])
+};
+
+#ifdef EVALEXP_X86_KERNELS
+
+// Note: The 'target' attribute lets these functions use the wider
+//       instructions without compiling the whole program for them; they
+//       are only ever called after the CPU said it has them.
+#define EVALEXP_VECTOR_KERNEL(isa, name, width, vtype, load, store, expr, tail) \
+    __attribute__((target(isa)))                                            \
+    static void name(const double* a, const double* b, double* r, size_t n) \
+    {                                                                       \
+        size_t i = 0;                                                       \
+        for(; i + width <= n; i += width) {                                 \
+            vtype va = load(a + i);                                         \
+            vtype vb = load(b + i);                                         \
+            store(r + i, expr);                                             \
+        }                                                                   \
+        for(; i < n; i++)                                                   \
+            r[i] = tail;                                                    \
+    }
+
+#define EVALEXP_VECTOR_UNARY(isa, name, width, vtype, load, store, expr, tail) \
+    __attribute__((target(isa)))                                            \
+    static void name(const double* a, const double*, double* r, size_t n)   \
+    {                                                                       \
+        size_t i = 0;                                                       \
+        for(; i + width <= n; i += width) {                                 \
+            vtype va = load(a + i);                                         \
+            store(r + i, expr);                                             \
+        }                                                                   \
+        for(; i < n; i++)                                                   \
+            r[i] = tail;                                                    \
+    }
+
+struct AVX2Kernels {
+    EVALEXP_VECTOR_KERNEL("avx2", Add, 4, __m256d, _mm256_loadu_pd, _mm256_storeu_pd,
+                          _mm256_add_pd(va, vb), a[i] + b[i])
+    EVALEXP_VECTOR_KERNEL("avx2", Sub, 4, __m256d, _mm256_loadu_pd, _mm256_storeu_pd,
+                          _mm256_sub_pd(va, vb), a[i] - b[i])
+    EVALEXP_VECTOR_KERNEL("avx2", Mul, 4, __m256d, _mm256_loadu_pd, _mm256_storeu_pd,
+                          _mm256_mul_pd(va, vb), a[i] * b[i])
+    EVALEXP_VECTOR_KERNEL("avx2", Div, 4, __m256d, _mm256_loadu_pd, _mm256_storeu_pd,
+                          _mm256_div_pd(va, vb), a[i] / b[i])
+    EVALEXP_VECTOR_UNARY("avx2", Neg, 4, __m256d, _mm256_loadu_pd, _mm256_storeu_pd,
+                         _mm256_xor_pd(va, _mm256_set1_pd(-0.0)), -a[i])
+};
+
+struct AVX512Kernels {
+    EVALEXP_VECTOR_KERNEL("avx512f", Add, 8, __m512d, _mm512_loadu_pd, _mm512_storeu_pd,
+                          _mm512_add_pd(va, vb), a[i] + b[i])
+    EVALEXP_VECTOR_KERNEL("avx512f", Sub, 8, __m512d, _mm512_loadu_pd, _mm512_storeu_pd,
+                          _mm512_sub_pd(va, vb), a[i] - b[i])
+    EVALEXP_VECTOR_KERNEL("avx512f", Mul, 8, __m512d, _mm512_loadu_pd, _mm512_storeu_pd,
+                          _mm512_mul_pd(va, vb), a[i] * b[i])
+    EVALEXP_VECTOR_KERNEL("avx512f", Div, 8, __m512d, _mm512_loadu_pd, _mm512_storeu_pd,
+                          _mm512_div_pd(va, vb), a[i] / b[i])
+    // Note: AVX-512F has no floating point xor, so flip the sign bit
+    //       through the integer view.
+    EVALEXP_VECTOR_UNARY("avx512f", Neg, 8, __m512d, _mm512_loadu_pd, _mm512_storeu_pd,
+                         _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(va),
+                                                              _mm512_set1_epi64(INT64_MIN))),
+                         -a[i])
+};
+
+#undef EVALEXP_VECTOR_KERNEL
+#undef EVALEXP_VECTOR_UNARY
+
+#endif
+
+#undef EVALEXP_SCALAR_KERNEL
+
+class BatchEvaluator
+{
+public:
+    enum { BlockSize = 256 };
+
+    enum KernelSet {
+        Auto,
+        Scalar,
+        AVX2,
+        AVX512
+    };
+
+private:
+    const BatchKernels*       m_Kernels;
+    PostfixExpression         m_Flattened;
+    std::vector<double>       m_Scratch;    // BlockSize values per column
+    std::vector<const double*> m_Columns;   // the column each node reads
+    std::vector<double*>      m_Targets;    // the output column it writes
+    std::vector<uint32_t>     m_ScratchOf;  // its scratch column
+    std::vector<uint32_t>     m_LastUse;    // the last node that reads it
+    std::vector<uint32_t>     m_Free;       // scratch columns not in use
+    std::map<uint64_t, uint32_t> m_ConstantColumns; // by the bits of the value
+
+    static const BatchKernels& Kernels(KernelSet set)
+    {
+        static const BatchKernels scalar = {
+            "scalar", ScalarKernels::Add, ScalarKernels::Sub,
+            ScalarKernels::Mul, ScalarKernels::Div, ScalarKernels::Neg
+        };
+#ifdef EVALEXP_X86_KERNELS
+        static const BatchKernels avx2 = {
+            "avx2", AVX2Kernels::Add, AVX2Kernels::Sub,
+            AVX2Kernels::Mul, AVX2Kernels::Div, AVX2Kernels::Neg
+        };
+        static const BatchKernels avx512 = {
+            "avx512", AVX512Kernels::Add, AVX512Kernels::Sub,
+            AVX512Kernels::Mul, AVX512Kernels::Div, AVX512Kernels::Neg
+        };
+
+        __builtin_cpu_init();
+        bool hasAVX512 = __builtin_cpu_supports("avx512f");
+        bool hasAVX2 = __builtin_cpu_supports("avx2");
+
+        if((set == Auto || set == AVX512) && hasAVX512)
+            return avx512;
+        if((set == Auto || set == AVX512 || set == AVX2) && hasAVX2)
+            return avx2;
+#else
+        (void)set;
+#endif
+        return scalar;
+    }
+
+    // Note: Gives each node that needs scratch space a column, the way a
+    //       compiler gives values registers: walking the nodes in order, the
+    //       columns of a node's operands are freed once it is their last
+    //       reader, and its own column is a free one if there is any. So a
+    //       node may overwrite the column of its operand, and the number of
+    //       columns is the most values alive at once -- for a chain, two --
+    //       not the number of nodes. Variables read their input column, an
+    //       operator that is an output writes into its output column, and
+    //       the other outputs stay alive to the end of the block. Each
+    //       distinct constant keeps a column of its own, filled once per
+    //       Evaluate() rather than once per block.
+    bool IsTemporary(const PostfixNode* nodes, uint32_t i) const
+    {
+        return m_ScratchOf[i] != (uint32_t)-1 && nodes[i].Op != NumberValue;
+    }
+
+    void Allocate(const PostfixNode* nodes, size_t count, const double* constants,
+                  const uint32_t* outputs, size_t outputCount)
+    {
+        const uint32_t none = (uint32_t)-1;
+
+        m_LastUse.assign(count, 0);
+        for(size_t i = 0; i < count; i++) {
+            const PostfixNode& node = nodes[i];
+            if(node.Op == NumberValue || node.Op == Variable)
+                continue;
+
+            if(node.Left >= i || (node.Op != UnaryMinus && node.Right >= i))
+                throw EvaluatorException("Incorrect syntax tree!");
+
+            m_LastUse[node.Left] = (uint32_t)i;
+            if(node.Op != UnaryMinus)
+                m_LastUse[node.Right] = (uint32_t)i;
+        }
+        for(size_t j = 0; j < outputCount; j++)
+            if(m_Targets[outputs[j]] == NULL)
+                m_LastUse[outputs[j]] = none;
+
+        m_ScratchOf.assign(count, none);
+        m_Free.clear();
+        m_ConstantColumns.clear();
+        uint32_t columns = 0;
+
+        for(size_t i = 0; i < count; i++) {
+            const PostfixNode& node = nodes[i];
+
+            if(node.Op == NumberValue) {
+                uint64_t bits;
+                memcpy(&bits, &constants[node.Left], sizeof(bits));
+
+                std::map<uint64_t, uint32_t>::iterator it = m_ConstantColumns.find(bits);
+                if(it == m_ConstantColumns.end())
+                    it = m_ConstantColumns.insert(std::make_pair(bits, columns++)).first;
+                m_ScratchOf[i] = it->second;
+                continue;
+            }
+
+            if(node.Op != Variable) {
+                if(m_LastUse[node.Left] == i && IsTemporary(nodes, node.Left))
+                    m_Free.push_back(m_ScratchOf[node.Left]);
+                if(node.Op != UnaryMinus && node.Right != node.Left
+                   && m_LastUse[node.Right] == i && IsTemporary(nodes, node.Right))
+                    m_Free.push_back(m_ScratchOf[node.Right]);
+            }
+
+            if(node.Op == Variable || m_Targets[i] != NULL)
+                continue;
+
+            if(m_Free.empty())
+                m_ScratchOf[i] = columns++;
+            else {
+                m_ScratchOf[i] = m_Free.back();
+                m_Free.pop_back();
+            }
+
+            // A node that nothing reads, e.g. left over from a failed
+            // parse, needs its column only while it is computed.
+            if(m_LastUse[i] == 0)
+                m_Free.push_back(m_ScratchOf[i]);
+        }
+
+        m_Scratch.resize(columns * BlockSize);
+    }
+
+    // Note: Outputs that are variables or constants, or a node that is
+    //       already written to another output, are copied to their output
+    //       column after each block.
+    void Run(const PostfixExpression& expr, const uint32_t* outputs, size_t outputCount,
+             const double* const* columns, size_t rows, double* const* results)
+    {
+        if(expr.Empty())
+            throw EvaluatorException("Incorrect abstract syntax tree");
+
+        size_t count = expr.Nodes.size();
+        const PostfixNode* nodes = &expr.Nodes[0];
+
+        m_Columns.assign(count, (const double*)NULL);
+        m_Targets.assign(count, (double*)NULL);
+
+        for(size_t j = 0; j < outputCount; j++) {
+            if(outputs[j] >= count)
+                throw EvaluatorException("Incorrect syntax tree!");
+
+            const PostfixNode& node = nodes[outputs[j]];
+            if(node.Op != NumberValue && node.Op != Variable && m_Targets[outputs[j]] == NULL)
+                m_Targets[outputs[j]] = results[j];
+        }
+
+        for(size_t i = 0; i < count; i++)
+            if(nodes[i].Op == Variable && columns == NULL)
+                throw EvaluatorException("No values given for the variables!");
+
+        const double* constants = expr.Constants.empty() ? NULL : &expr.Constants[0];
+        Allocate(nodes, count, constants, outputs, outputCount);
+
+        for(std::map<uint64_t, uint32_t>::const_iterator it = m_ConstantColumns.begin();
+            it != m_ConstantColumns.end(); ++it) {
+            double value;
+            memcpy(&value, &it->first, sizeof(value));
+
+            double* r = &m_Scratch[it->second * BlockSize];
+            for(size_t k = 0; k < BlockSize; k++)
+                r[k] = value;
+        }
+
+        for(size_t start = 0; start < rows; start += BlockSize) {
+            size_t n = rows - start < BlockSize ? rows - start : (size_t)BlockSize;
+
+            for(size_t i = 0; i < count; i++) {
+                const PostfixNode& node = nodes[i];
+
+                // Note: Variables read straight from the input columns.
+                if(node.Op == Variable) {
+                    m_Columns[i] = columns[node.Left] + start;
+                    continue;
+                }
+
+                double* r = m_Targets[i] != NULL ? m_Targets[i] + start
+                                                 : &m_Scratch[m_ScratchOf[i] * BlockSize];
+                m_Columns[i] = r;
+
+                if(node.Op == NumberValue)
+                    continue;
+
+                const double* a = m_Columns[node.Left];
+                const double* b = node.Op == UnaryMinus ? NULL : m_Columns[node.Right];
+
+                switch(node.Op) {
+                case OperatorPlus:  m_Kernels->Add(a, b, r, n); break;
+                case OperatorMinus: m_Kernels->Sub(a, b, r, n); break;
+                case OperatorMul:   m_Kernels->Mul(a, b, r, n); break;
+                case OperatorDiv:   m_Kernels->Div(a, b, r, n); break;
+                case UnaryMinus:    m_Kernels->Neg(a, b, r, n); break;
+                default:
+                    throw EvaluatorException("Incorrect syntax tree!");
+                }
+            }
+
+            for(size_t j = 0; j < outputCount; j++) {
+                const double* column = m_Columns[outputs[j]];
+                double* r = results[j] + start;
+                if(column != r)
+                    for(size_t k = 0; k < n; k++) r[k] = column[k];
+            }
+        }
+    }
+
+public:
+    // Asking for a kernel set the CPU does not have gives the next best one.
+    BatchEvaluator(KernelSet set = Auto):
+        m_Kernels(&Kernels(set))
+    {
+    }
+
+    const char* KernelName() const
+    {
+        return m_Kernels->Name;
+    }
+
+    // The scratch columns of BlockSize values the last Evaluate() used.
+    size_t ScratchColumns() const
+    {
+        return m_Scratch.size() / BlockSize;
+    }
+
+    void Evaluate(const PostfixExpression& expr, const double* const* columns,
+                  size_t rows, double* output)
+    {
+        uint32_t root = expr.Root();
+        Run(expr, &root, 1, columns, rows, &output);
+    }
+
+    // Evaluates several expressions that share one set of nodes, as in an
+    // ExpressionSet: 'results[k]' is the output column of node outputs[k].
+    // Each node is computed once per block, whichever outputs need it.
+    void Evaluate(const PostfixExpression& expr, const uint32_t* outputs, size_t count,
+                  const double* const* columns, size_t rows, double* const* results)
+    {
+        Run(expr, outputs, count, columns, rows, results);
+    }
+
+    void Evaluate(ASTNode* ast, const double* const* columns,
+                  size_t rows, double* output)
+    {
+        if(ast == NULL)
+            throw EvaluatorException("Incorrect abstract syntax tree");
+
+        // Note: Repeated subexpressions are shared, so each is computed
+        //       once per block.
+        DagBuilder builder(&m_Flattened);
+        if(!Flatten(ast, builder))
+            throw EvaluatorException("Incorrect syntax tree!");
+
+        Evaluate(m_Flattened, columns, rows, output);
+    }
+};
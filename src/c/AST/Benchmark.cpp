@@ -0,0 +1,673 @@
+/*
+ * Benchmark.cpp - Times the different ways of evaluating an expression.
+ *
+ * Build: g++ -O2 -std=c++11 -pthread -o benchmark Benchmark.cpp
+ *
+ * Note: Each case is parsed once and then evaluated over and over again,
+ *       by walking the tree (Evaluator, recursively, with an explicit stack
+ *       and in the default mix of both), by running the compiled program
+ *       (VirtualMachine) and by calling the native code of the JIT. The
+ *       results have to agree bit for bit. A '*' after the JIT time means
+ *       there was no JIT and the VM ran instead.
+ *
+ *       The teardown cases time deleting a tree against resetting an
+ *       arena, for shallow trees and for very deep ones.
+ *
+ *       The cache cases look up a small working set of formulas over and
+ *       over again, against parsing them every time.
+ *
+ *       The batch cases evaluate one expression with variables over a
+ *       million rows, once per row with the Evaluator, and per block of
+ *       rows with each BatchEvaluator kernel set.
+ *
+ *       The optimizer cases give the nodes of mostly constant formulas
+ *       before and after the Optimizer, in strict and in fast-math mode,
+ *       and the Evaluator's time for each tree.
+ *
+ *       The sharing cases give the nodes and bytes of formulas with
+ *       repeated subexpressions as a tree and as a DAG (DagBuilder), and
+ *       the Evaluator's time for the tree, for the postfix form without
+ *       sharing and for the DAG.
+ *
+ *       The rebalance cases give the depth of long sums and products of
+ *       variables before and after the FastMath Optimizer rebuilds their
+ *       chains as balanced trees, with the time of the Evaluator and the JIT
+ *       for each, and how far apart the results are.
+ *
+ *       The formula set cases evaluate a few hundred related formulas over
+ *       the same inputs, each on its own and compiled together into one
+ *       ExpressionSet, per row and per block of rows.
+ *
+ *       The parallel cases evaluate trees of millions of nodes with the
+ *       ParallelEvaluator on 1, 2, 4, ... threads up to the number of
+ *       cores, against the Evaluator alone (strong scaling).
+ */
+
+#include "Parser.h"
+#include "Evaluator.h"
+#include "Bytecode.h"
+#include "Jit.h"
+#include "Dag.h"
+#include "BatchEvaluator.h"
+#include "ExpressionSet.h"
+#include "ParallelEvaluator.h"
+#include "ExpressionCache.h"
+#include "Optimizer.h"
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+
+static volatile double g_sink;
+
+template<class F>
+double NanosecondsPerCall(F f, size_t iterations)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    double sum = 0;
+    for(size_t i = 0; i < iterations; i++)
+        sum += f();
+
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+    g_sink = sum;
+
+    return std::chrono::duration<double, std::nano>(stop - start).count() / iterations;
+}
+
+// "1+2*3-4/5+6*7-..." with the given number of terms.
+static std::string MakeChain(int terms)
+{
+    static const char ops[] = "+*-/";
+
+    std::string text = "1";
+    for(int i = 1; i < terms; i++) {
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "%c%d", ops[i % 4], i % 9 + 1);
+        text += buffer;
+    }
+
+    return text;
+}
+
+// A full binary tree of the given depth, "((1+2)*(3-4))/((5+6)*(7-8))...";
+// its stack needs depth + 1 entries.
+static std::string MakeBalanced(int depth, int& leaf)
+{
+    static const char ops[] = "+*-/";
+
+    if(depth == 0) {
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "%d", leaf++ % 9 + 1);
+        return buffer;
+    }
+
+    std::string left = MakeBalanced(depth - 1, leaf);
+    return "(" + left + ops[depth % 4] + MakeBalanced(depth - 1, leaf) + ")";
+}
+
+// Note: Trees too deep for the native stack ('recursive' false) are not
+//       evaluated with the purely recursive Evaluator.
+static void BenchEvaluate(const char* name, const char* text, size_t iterations,
+                          bool recursive = true)
+{
+    Parser parser;
+    parser.SetMaxDepth(0);
+    ASTNode* ast = parser.Parse(text);
+
+    Program program;
+    Compiler().Compile(ast, program);
+
+    Evaluator plain(Evaluator::Recursive);
+    Evaluator eval;
+    Evaluator stack(Evaluator::ExplicitStack);
+    VirtualMachine vm;
+    JitExpression jit;
+    jit.Compile(program);
+
+    double expected = eval.Evaluate(ast);
+    double viaStack = stack.Evaluate(ast);
+    double actual = vm.Run(program);
+    double native = jit.Evaluate();
+    if(memcmp(&expected, &actual, sizeof(double)) != 0
+       || memcmp(&expected, &viaStack, sizeof(double)) != 0
+       || memcmp(&expected, &native, sizeof(double)) != 0)
+        printf("%-24s MISMATCH: tree %.17g, stack %.17g, vm %.17g, jit %.17g\n",
+               name, expected, viaStack, actual, native);
+
+    double flat = recursive ? NanosecondsPerCall([&]() { return plain.Evaluate(ast); }, iterations) : 0;
+    double tree = NanosecondsPerCall([&]() { return eval.Evaluate(ast); }, iterations);
+    double heap = NanosecondsPerCall([&]() { return stack.Evaluate(ast); }, iterations);
+    double code = NanosecondsPerCall([&]() { return vm.Run(program); }, iterations);
+    double machine = NanosecondsPerCall([&]() { return jit.Evaluate(); }, iterations);
+
+    char column[32] = "-";
+    if(recursive)
+        snprintf(column, sizeof(column), "%.1f", flat);
+
+    printf("%-24s %10s %10.1f %10.1f %10.1f %10.1f%s %8.2fx %8.2fx\n", name, column, tree, heap,
+           code, machine, jit.IsNative() ? " " : "*", tree / code, code / machine);
+
+    delete ast;
+}
+
+// Parse 'text' 'iterations' times, and time only getting rid of the trees.
+static void BenchTeardown(const char* name, const char* text, size_t iterations)
+{
+    double deleting = 0, resetting = 0;
+
+    Parser parser;
+    parser.SetMaxDepth(0);
+    for(size_t i = 0; i < iterations; i++) {
+        ASTNode* ast = parser.Parse(text);
+        deleting += NanosecondsPerCall([&]() { delete ast; return 0.0; }, 1);
+    }
+
+    NodeArena arena;
+    Parser arenaParser(&arena);
+    arenaParser.SetMaxDepth(0);
+    for(size_t i = 0; i < iterations; i++) {
+        arenaParser.Parse(text);
+        resetting += NanosecondsPerCall([&]() { arena.Reset(); return 0.0; }, 1);
+    }
+
+    printf("%-24s %10.1f %10.1f\n", name, deleting / iterations, resetting / iterations);
+}
+
+static void BenchBatch(const char* text, size_t rows)
+{
+    SymbolTable symbols;
+    symbols.Declare("x");
+    symbols.Declare("y");
+
+    PostfixExpression expr;
+    PostfixParser(&expr, &symbols).Parse(text);
+
+    std::vector<double> xs(rows), ys(rows), results(rows), expected(rows);
+    for(size_t i = 0; i < rows; i++) {
+        xs[i] = (double)(i % 1000) / 7;
+        ys[i] = (double)(i % 777) / 3 + 1;
+    }
+    const double* columns[] = { &xs[0], &ys[0] };
+
+    Evaluator eval;
+    double row = NanosecondsPerCall([&]() {
+        for(size_t i = 0; i < rows; i++) {
+            double slots[] = { xs[i], ys[i] };
+            expected[i] = eval.Evaluate(expr, slots);
+        }
+        return expected[0];
+    }, 1) / rows;
+
+    printf("%-24s %-8s %8.2f ns/row\n", text, "per-row", row);
+
+    static const BatchEvaluator::KernelSet sets[] = {
+        BatchEvaluator::Scalar, BatchEvaluator::AVX2, BatchEvaluator::AVX512
+    };
+    for(size_t k = 0; k < sizeof(sets) / sizeof(sets[0]); k++) {
+        BatchEvaluator batch(sets[k]);
+        double block = NanosecondsPerCall([&]() {
+            batch.Evaluate(expr, columns, rows, &results[0]);
+            return results[0];
+        }, 1) / rows;
+
+        bool same = memcmp(&results[0], &expected[0], rows * sizeof(double)) == 0;
+        printf("%-24s %-8s %8.2f ns/row %8.2fx%s\n", text, batch.KernelName(),
+               block, row / block, same ? "" : "  MISMATCH");
+    }
+}
+
+// Like MakeChain, with every 'every'-th number replaced by x, y or z.
+static std::string MakeMostlyConstant(int terms, int every)
+{
+    static const char ops[] = "+*-/";
+
+    std::string text = "x";
+    for(int i = 1; i < terms; i++) {
+        char buffer[16];
+        if(i % every == 0)
+            snprintf(buffer, sizeof(buffer), "%c%c", ops[i % 4], "xyz"[i / every % 3]);
+        else
+            snprintf(buffer, sizeof(buffer), "%c%d", ops[i % 4], i % 9 + 1);
+        text += buffer;
+    }
+
+    return text;
+}
+
+static void BenchOptimizer(const char* name, const char* text, size_t iterations)
+{
+    SymbolTable symbols;
+    symbols.Declare("x");
+    symbols.Declare("y");
+    symbols.Declare("z");
+    Parser parser(NULL, &symbols);
+
+    ASTNode* plain = parser.Parse(text);
+    Optimizer strict(Optimizer::Strict), fast(Optimizer::FastMath);
+    ASTNode* exact = strict.Optimize(parser.Parse(text));
+    ASTNode* folded = fast.Optimize(parser.Parse(text));
+
+    double slots[] = { 1.5, -2.25, 3 };
+    Evaluator eval;
+    double expected = eval.Evaluate(plain, slots);
+    double actual = eval.Evaluate(exact, slots);
+
+    double before = NanosecondsPerCall([&]() { return eval.Evaluate(plain, slots); }, iterations);
+    double after = NanosecondsPerCall([&]() { return eval.Evaluate(exact, slots); }, iterations);
+    double fastest = NanosecondsPerCall([&]() { return eval.Evaluate(folded, slots); }, iterations);
+
+    printf("%-24s %7zu %7zu %7zu %10.1f %10.1f %10.1f %8.2fx %8.2fx%s\n", name,
+           strict.GetStatistics().NodesBefore, strict.GetStatistics().NodesAfter,
+           fast.GetStatistics().NodesAfter, before, after, fastest, before / after,
+           before / fastest, memcmp(&expected, &actual, sizeof(double)) == 0 ? "" : "  MISMATCH");
+
+    delete plain;
+    delete exact;
+    delete folded;
+}
+
+// Nests 'depth' times s -> (s/(1+s*s)), starting from (x-y), so the tree
+// grows threefold per level while the DAG grows by four nodes.
+static std::string MakeRepeated(int depth)
+{
+    std::string text = "(x-y)";
+    for(int i = 0; i < depth; i++)
+        text = "(" + text + "/(1+" + text + "*" + text + "))";
+
+    return text;
+}
+
+static void BenchDag(const char* name, const char* text, size_t iterations)
+{
+    SymbolTable symbols;
+    symbols.Declare("x");
+    symbols.Declare("y");
+    symbols.Declare("z");
+
+    Parser parser(NULL, &symbols);
+    parser.SetMaxDepth(0);
+    ASTNode* ast = parser.Parse(text);
+
+    PostfixExpression flat, dag;
+    Flatten(ast, flat);
+    DagBuilder builder(&dag);
+    Flatten(ast, builder);
+    DagBuilder::Statistics stats = builder.GetStatistics();
+
+    double slots[] = { 1.5, -2.25, 3 };
+    Evaluator eval;
+    double expected = eval.Evaluate(ast, slots);
+    double actual = eval.Evaluate(dag, slots);
+
+    double tree = NanosecondsPerCall([&]() { return eval.Evaluate(ast, slots); }, iterations);
+    double postfix = NanosecondsPerCall([&]() { return eval.Evaluate(flat, slots); }, iterations);
+    double shared = NanosecondsPerCall([&]() { return eval.Evaluate(dag, slots); }, iterations);
+
+    printf("%-24s %7zu %7zu %9zu %9zu %10.1f %10.1f %10.1f %8.2fx%s\n", name,
+           stats.TreeNodes, stats.DagNodes, stats.TreeBytes, stats.DagBytes, tree, postfix,
+           shared, tree / shared, memcmp(&expected, &actual, sizeof(double)) == 0 ? "" : "  MISMATCH");
+
+    delete ast;
+}
+
+// "x+y+z+x+..." or "x*y*z*x*..." with the given number of terms.
+static std::string MakeVariables(int terms, char op)
+{
+    std::string text = "x";
+    for(int i = 1; i < terms; i++) {
+        text += op;
+        text += "xyz"[i % 3];
+    }
+
+    return text;
+}
+
+static void BenchRebalance(const char* name, const char* text, size_t iterations)
+{
+    SymbolTable symbols;
+    symbols.Declare("x");
+    symbols.Declare("y");
+    symbols.Declare("z");
+    Parser parser(NULL, &symbols);
+    parser.SetMaxDepth(0);
+
+    Optimizer fast(Optimizer::FastMath), balanced(Optimizer::FastMath);
+    balanced.SetRebalance(true);
+    ASTNode* chain = fast.Optimize(parser.Parse(text));
+    ASTNode* tree = balanced.Optimize(parser.Parse(text));
+
+    JitExpression chainCode, treeCode;
+    chainCode.Compile(chain);
+    treeCode.Compile(tree);
+
+    double slots[] = { 1.0001, 0.9999, 1.00005 };
+    Evaluator eval;
+    double expected = eval.Evaluate(chain, slots);
+    double actual = eval.Evaluate(tree, slots);
+
+    double before = NanosecondsPerCall([&]() { return eval.Evaluate(chain, slots); }, iterations);
+    double after = NanosecondsPerCall([&]() { return eval.Evaluate(tree, slots); }, iterations);
+    double nativeBefore = NanosecondsPerCall([&]() { return chainCode.Evaluate(slots); }, iterations);
+    double nativeAfter = NanosecondsPerCall([&]() { return treeCode.Evaluate(slots); }, iterations);
+
+    printf("%-24s %7zu %7zu %10.1f %10.1f %8.2fx %10.1f %10.1f%s %8.2fx %9.1e\n", name,
+           balanced.GetStatistics().DepthBefore, balanced.GetStatistics().DepthAfter,
+           before, after, before / after, nativeBefore, nativeAfter,
+           treeCode.IsNative() ? " " : "*", nativeBefore / nativeAfter,
+           fabs(actual - expected) / fabs(expected));
+
+    delete chain;
+    delete tree;
+}
+
+// Formulas over x, y, z and w made of a few common parts, as they come
+// out of a generator of related features.
+static std::string MakeRelated(int index)
+{
+    static const char* parts[] = {
+        "(x-y)", "(x+y)", "(x*y+1)", "(z*z+1)", "(x-y)*(x-y)",
+        "(y-z)/(z*z+1)", "(w-x)*(w+x)", "(z+w)/(x*y+1)"
+    };
+    static const char ops[] = "+*-/";
+
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s%c%s%c%d*%s", parts[index % 8], ops[index % 4],
+             parts[index / 8 % 8], ops[index / 3 % 4], index % 9 + 1, parts[(index * 3 + 1) % 8]);
+    return buffer;
+}
+
+static void BenchExpressionSet(int count, size_t rows)
+{
+    SymbolTable symbols;
+    symbols.Declare("x");
+    symbols.Declare("y");
+    symbols.Declare("z");
+    symbols.Declare("w");
+
+    Parser parser(NULL, &symbols);
+    ExpressionSet set(&symbols);
+    std::vector<ASTNode*> trees;
+    std::vector<PostfixExpression> flat(count);
+
+    for(int i = 0; i < count; i++) {
+        std::string text = MakeRelated(i);
+        trees.push_back(parser.Parse(text.c_str()));
+        Flatten(trees.back(), flat[i]);
+        set.Add(text.c_str());
+    }
+
+    std::vector<double> inputs(4 * rows);
+    for(size_t i = 0; i < inputs.size(); i++)
+        inputs[i] = (double)(i * 7919 % 1000) / 100 - 5;
+    const double* columns[] = { &inputs[0], &inputs[rows], &inputs[2 * rows], &inputs[3 * rows] };
+
+    std::vector<double> expected(count * rows), actual(count * rows), batched(count * rows);
+    std::vector<double*> outputs(count);
+    for(int i = 0; i < count; i++)
+        outputs[i] = &batched[i * rows];
+
+    Evaluator eval;
+    BatchEvaluator batch;
+
+    double single = NanosecondsPerCall([&]() {
+        for(size_t r = 0; r < rows; r++) {
+            double slots[] = { columns[0][r], columns[1][r], columns[2][r], columns[3][r] };
+            for(int i = 0; i < count; i++)
+                expected[i * rows + r] = eval.Evaluate(trees[i], slots);
+        }
+        return 0.0;
+    }, 1) / rows;
+
+    double shared = NanosecondsPerCall([&]() {
+        std::vector<double> results(count);
+        for(size_t r = 0; r < rows; r++) {
+            double slots[] = { columns[0][r], columns[1][r], columns[2][r], columns[3][r] };
+            set.Evaluate(slots, &results[0]);
+            for(int i = 0; i < count; i++)
+                actual[i * rows + r] = results[i];
+        }
+        return 0.0;
+    }, 1) / rows;
+
+    std::vector<double> scratch(rows);
+    double blocks = NanosecondsPerCall([&]() {
+        for(int i = 0; i < count; i++)
+            batch.Evaluate(flat[i], columns, rows, &scratch[0]);
+        return scratch[0];
+    }, 1) / rows;
+
+    double sharedBlocks = NanosecondsPerCall([&]() {
+        set.Evaluate(columns, rows, &outputs[0]);
+        return batched[0];
+    }, 1) / rows;
+
+    bool same = memcmp(&expected[0], &actual[0], expected.size() * sizeof(double)) == 0
+             && memcmp(&expected[0], &batched[0], expected.size() * sizeof(double)) == 0;
+
+    DagBuilder::Statistics stats = set.GetStatistics();
+    printf("%3d formulas %7zu -> %5zu nodes  rows %8.1f -> %7.1f ns/row %6.2fx"
+           "  blocks %7.1f -> %6.1f ns/row %6.2fx%s\n", count, stats.TreeNodes, stats.DagNodes,
+           single, shared, single / shared, blocks, sharedBlocks, blocks / sharedBlocks,
+           same ? "" : "  MISMATCH");
+
+    for(int i = 0; i < count; i++)
+        delete trees[i];
+}
+
+static void BenchParallel(const char* name, const char* text, bool rebalance, size_t iterations)
+{
+    SymbolTable symbols;
+    symbols.Declare("x");
+    symbols.Declare("y");
+    symbols.Declare("z");
+    Parser parser(NULL, &symbols);
+    parser.SetMaxDepth(0);
+    ASTNode* ast = parser.Parse(text);
+
+    if(rebalance) {
+        Optimizer optimizer(Optimizer::FastMath);
+        optimizer.SetRebalance(true);
+        ast = optimizer.Optimize(ast);
+        ParallelEvaluator::Annotate(ast);
+    }
+
+    double slots[] = { 1.0001, 0.9999, 1.00005 };
+    Evaluator eval;
+    double expected = eval.Evaluate(ast, slots);
+    double single = NanosecondsPerCall([&]() { return eval.Evaluate(ast, slots); }, iterations);
+
+    unsigned cores = std::thread::hardware_concurrency();
+    if(cores == 0)
+        cores = 1;
+
+    for(unsigned threads = 1; ; threads = threads * 2 < cores ? threads * 2 : cores) {
+        ParallelEvaluator parallel(threads);
+        double actual = parallel.Evaluate(ast, slots);
+        double time = NanosecondsPerCall([&]() { return parallel.Evaluate(ast, slots); }, iterations);
+
+        printf("%-24s %7u %10u %12.3f %12.3f %8.2fx %8.0f%%%s\n", name, threads,
+               ASTNode::SubtreeSize(ast), single / 1e6, time / 1e6, single / time,
+               100 * single / time / threads,
+               memcmp(&expected, &actual, sizeof(double)) == 0 ? "" : "  MISMATCH");
+
+        if(threads == cores)
+            break;
+    }
+
+    delete ast;
+}
+
+static void BenchCache(size_t lookups, int threads)
+{
+    static const char* formulas[] = {
+        "x*x + 2*y - x/(y+1)",
+        "(a+b)*(a-b)/(c*c+1)",
+        "-(x-y)*(x+y)/(x*y+1)",
+        "1.5*price*(1-discount) + shipping",
+        "(p1+p2+p3+p4)/4 - baseline",
+        "rate*rate*principal/(1+rate)",
+        "-x/(1+y*y) + z*(x-y)",
+        "w1*f1 + w2*f2 + w3*f3 + w4*f4 + bias"
+    };
+    const size_t count = sizeof(formulas) / sizeof(formulas[0]);
+
+    double parsing = NanosecondsPerCall([&]() {
+        double sum = 0;
+        for(size_t i = 0; i < lookups; i++) {
+            SymbolTable symbols;
+            PostfixExpression expr;
+            PostfixParser(&expr, &symbols).Parse(formulas[i % count]);
+            sum += expr.Nodes.size();
+        }
+        return sum;
+    }, 1) / lookups;
+
+    ExpressionCache cache(1 << 20);
+    std::vector<std::string> texts(formulas, formulas + count);
+
+    double cached = NanosecondsPerCall([&]() {
+        std::vector<std::thread> workers;
+        for(int t = 0; t < threads; t++)
+            workers.push_back(std::thread([&, t]() {
+                for(size_t i = t; i < lookups; i += threads)
+                    cache.Get(texts[i % count]);
+            }));
+        for(int t = 0; t < threads; t++)
+            workers[t].join();
+        return 0.0;
+    }, 1) / lookups;
+
+    ExpressionCache::Statistics stats = cache.GetStatistics();
+    printf("cache, %d thread(s)        parse %8.1f ns  lookup %8.1f ns  %8.2fx"
+           "  (%llu hits, %llu misses, %llu evictions, %zu bytes)\n",
+           threads, parsing, cached, parsing / cached,
+           (unsigned long long)stats.Hits, (unsigned long long)stats.Misses,
+           (unsigned long long)stats.Evictions, stats.Bytes);
+}
+
+int main(int argc, char* argv[])
+{
+    static const char* cases[] = {
+        "1+2+3+4",
+        "1*2*3*4",
+        "1-2-3-4",
+        "1/2/3/4",
+        "1*2+3*4",
+        "1+2*3+4",
+        "(1+2)*(3+4)",
+        "1+(2*3)*(4+5)",
+        "1+(2*3)/4+5",
+        "5/(4+3)/2",
+        "1 + 2.5",
+        "125",
+        "-1",
+        "-1+(-2)",
+        "-1+(-2.0)"
+    };
+
+    size_t iterations = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+
+    printf("%-24s %10s %10s %10s %10s %11s %9s %9s\n", "expression",
+           "recurse ns", "auto ns", "stack ns", "vm ns", "jit ns", "auto/vm", "vm/jit");
+
+    for(size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        BenchEvaluate(cases[i], cases[i], iterations);
+
+    static const int sizes[] = { 10, 100, 1000, 10000 };
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "chain(%d)", sizes[i]);
+        std::string text = MakeChain(sizes[i]);
+        BenchEvaluate(name, text.c_str(), iterations / sizes[i] + 1);
+    }
+
+    static const int levels[] = { 4, 12, 16 };
+    for(size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "balanced(%d)", levels[i]);
+        int leaf = 0;
+        std::string text = MakeBalanced(levels[i], leaf);
+        BenchEvaluate(name, text.c_str(), iterations / (1 << levels[i]) + 1);
+    }
+
+    static const int depths[] = { 100000, 1000000 };
+    for(size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "nested(%d)", depths[i]);
+        std::string text = std::string(depths[i], '(') + "1";
+        for(int k = 0; k < depths[i]; k++)
+            text += "-1)";
+        BenchEvaluate(name, text.c_str(), 10, false);
+    }
+
+    printf("\n%-24s %10s %10s\n", "teardown", "delete ns", "reset ns");
+    BenchTeardown("(1+2)*(3+4)", "(1+2)*(3+4)", iterations / 10 + 1);
+    std::string chain = MakeChain(1000);
+    BenchTeardown("chain(1000)", chain.c_str(), iterations / 1000 + 1);
+    std::string deep = std::string(1000000, '-') + "1";
+    BenchTeardown("negated(1000000)", deep.c_str(), 3);
+
+    printf("\n");
+    BenchCache(iterations, 1);
+    BenchCache(iterations, 4);
+
+    printf("\n");
+    BenchBatch("x*x + 2*y - x/(y+1)", iterations);
+    BenchBatch("-(x-y)*(x+y)/(x*y+1)", iterations);
+
+    printf("\n%-24s %7s %7s %7s %10s %10s %10s %9s %9s\n", "optimizer", "nodes",
+           "strict", "fast", "plain ns", "strict ns", "fast ns", "strict", "fast");
+    BenchOptimizer("x*(2*3) + 4*5 - 1", "x*(2*3) + 4*5 - 1", iterations);
+    BenchOptimizer("units", "(1+2)*x*1 + 0*y - -(-(y/1))", iterations);
+    BenchOptimizer("scaled", "2*x*3 + 1 + y - 4 + 0.5*z*4/8", iterations);
+    static const int terms[] = { 100, 1000 };
+    for(size_t i = 0; i < sizeof(terms) / sizeof(terms[0]); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "mostly constant(%d)", terms[i]);
+        std::string text = MakeMostlyConstant(terms[i], 10);
+        BenchOptimizer(name, text.c_str(), iterations / terms[i] + 1);
+    }
+
+    printf("\n%-24s %7s %7s %9s %9s %10s %10s %10s %9s\n", "sharing", "tree",
+           "dag", "tree B", "dag B", "tree ns", "flat ns", "dag ns", "tree/dag");
+    BenchDag("(a+b)*(a+b)/(a+b)", "(x+y)*(x+y)/(x+y)", iterations);
+    BenchDag("distances", "(x-y)*(x-y) + (y-z)*(y-z) + (x-y)*(y-z)/((x-y)*(x-y)+1)",
+             iterations);
+    static const int nestings[] = { 4, 8 };
+    for(size_t i = 0; i < sizeof(nestings) / sizeof(nestings[0]); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "repeated(%d)", nestings[i]);
+        std::string text = MakeRepeated(nestings[i]);
+        BenchDag(name, text.c_str(), iterations / text.size() + 1);
+    }
+
+    printf("\n%-24s %7s %7s %10s %10s %9s %10s %11s %9s %9s\n", "rebalance", "depth",
+           "after", "chain ns", "tree ns", "eval", "jit ns", "jit tree ns", "jit", "rel diff");
+    static const int lengths[] = { 8, 64, 1000, 100000 };
+    for(size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "sum(%d)", lengths[i]);
+        std::string text = MakeVariables(lengths[i], '+');
+        BenchRebalance(name, text.c_str(), iterations / lengths[i] + 1);
+        snprintf(name, sizeof(name), "product(%d)", lengths[i]);
+        text = MakeVariables(lengths[i], '*');
+        BenchRebalance(name, text.c_str(), iterations / lengths[i] + 1);
+    }
+
+    printf("\n");
+    BenchExpressionSet(64, iterations / 100 + 1);
+    BenchExpressionSet(512, iterations / 100 + 1);
+
+    printf("\n%-24s %7s %10s %12s %12s %9s %9s\n", "parallel", "threads", "nodes",
+           "single ms", "parallel ms", "speedup", "per core");
+    int leaf = 0;
+    std::string balanced = MakeBalanced(20, leaf);
+    BenchParallel("balanced(20)", balanced.c_str(), false, iterations / 100000 + 1);
+    std::string sum = MakeVariables(1000000, '+');
+    BenchParallel("sum(1000000) rebalanced", sum.c_str(), true, iterations / 100000 + 1);
+
+    return 0;
+}
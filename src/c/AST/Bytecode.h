@@ -0,0 +1,202 @@
+/*
+ * Bytecode.h - Compiles an AST to bytecode for a small stack machine.
+ *
+ * Note: The Evaluator walks the tree and re-dispatches on every node for
+ *       every evaluation. When the same expression is evaluated over and
+ *       over again, it pays to lower the tree, once, to a flat program and
+ *       run that instead:
+ *
+ *       For example, the program for '1+2*3' is,
+ *
+ *        PUSH 0        ; constant 0 = 1
+ *        PUSH 1        ; constant 1 = 2
+ *        PUSH 2        ; constant 2 = 3
+ *        MUL
+ *        ADD
+ *        RET
+ *
+ *       Each instruction is one 32-bit word; PUSH and LOAD are followed by
+ *       a second word with the index of their constant or variable slot.
+ *       The VM keeps the top of the stack in a local, so a binary operator
+ *       is one load and one arithmetic instruction.
+ *
+ *       With GCC and clang, the VM dispatches through a table of label
+ *       addresses (computed goto); otherwise through a plain switch.
+ */
+
+#ifndef BYTECODE_H
+#  define BYTECODE_H 1
+#endif
+
+#include <vector>
+#include <stdint.h>
+
+#ifndef AST_H
+#  include "AST.h"
+#endif
+
+#ifndef EVALUATOR_H
+#  include "Evaluator.h"
+#endif
+
+#if defined(__GNUC__) && !defined(EVALEXP_NO_COMPUTED_GOTO)
+#  define EVALEXP_COMPUTED_GOTO 1
+#endif
+
+enum OpCode {
+    OpPush,
+    OpLoad,
+    OpAdd,
+    OpSub,
+    OpMul,
+    OpDiv,
+    OpNeg,
+    OpReturn
+};
+
+struct Program {
+    std::vector<uint32_t> Code;
+    std::vector<double>   Constants;
+    size_t                MaxStack;
+    bool                  UsesSlots;
+
+    Program():MaxStack(0), UsesSlots(false)
+    {}
+};
+
+class Compiler
+{
+    PostfixExpression m_Postfix;
+
+public:
+    // Note: The tree is first flattened to postfix order, left operands
+    //       first, which is exactly the order of the stack code; so deep
+    //       trees compile without any recursion. The checks are those of
+    //       Evaluator::EvaluateSubtree.
+    void Compile(ASTNode* ast, Program& program)
+    {
+        if(ast == NULL)
+            throw EvaluatorException("Incorrect abstract syntax tree");
+
+        if(!Flatten(ast, m_Postfix))
+            throw EvaluatorException("Incorrect syntax tree!");
+
+        program.Code.clear();
+        program.Constants = m_Postfix.Constants;
+        program.MaxStack = 0;
+        program.UsesSlots = false;
+
+        size_t depth = 0;
+        for(size_t i = 0; i < m_Postfix.Nodes.size(); i++) {
+            const PostfixNode& node = m_Postfix.Nodes[i];
+
+            switch(node.Op) {
+            case NumberValue:
+                program.Code.push_back(OpPush);
+                program.Code.push_back(node.Left);
+                depth++;
+                break;
+
+            case Variable:
+                program.Code.push_back(OpLoad);
+                program.Code.push_back(node.Left);
+                program.UsesSlots = true;
+                depth++;
+                break;
+
+            case UnaryMinus:    program.Code.push_back(OpNeg); break;
+            case OperatorPlus:  program.Code.push_back(OpAdd); depth--; break;
+            case OperatorMinus: program.Code.push_back(OpSub); depth--; break;
+            case OperatorMul:   program.Code.push_back(OpMul); depth--; break;
+            case OperatorDiv:   program.Code.push_back(OpDiv); depth--; break;
+            }
+
+            if(depth > program.MaxStack)
+                program.MaxStack = depth;
+        }
+
+        program.Code.push_back(OpReturn);
+    }
+};
+
+class VirtualMachine
+{
+    std::vector<double> m_Stack;
+
+public:
+    // Note: The program must come from Compiler::Compile; the VM does not
+    //       check its opcodes or its stack depth again.
+    double Run(const Program& program, const double* slots = NULL)
+    {
+        if(program.Code.empty())
+            throw EvaluatorException("Incorrect abstract syntax tree");
+
+        if(program.UsesSlots && slots == NULL)
+            throw EvaluatorException("No values given for the variables!");
+
+        if(m_Stack.size() < program.MaxStack + 1)
+            m_Stack.resize(program.MaxStack + 1);
+
+        const uint32_t* ip = &program.Code[0];
+        const double* constants = program.Constants.empty() ? NULL : &program.Constants[0];
+        double* sp = &m_Stack[0];
+        double top = 0;
+
+#ifdef EVALEXP_COMPUTED_GOTO
+        static const void* labels[] = {
+            &&Label_OpPush, &&Label_OpLoad, &&Label_OpAdd, &&Label_OpSub,
+            &&Label_OpMul, &&Label_OpDiv, &&Label_OpNeg, &&Label_OpReturn
+        };
+#  define VM_CASE(op) Label_##op
+#  define VM_NEXT()   goto *labels[*ip++]
+        VM_NEXT();
+        {
+#else
+#  define VM_CASE(op) case op
+#  define VM_NEXT()   continue
+        for(;;) {
+            switch(*ip++) {
+#endif
+        VM_CASE(OpPush):
+            *sp++ = top;
+            top = constants[*ip++];
+            VM_NEXT();
+        VM_CASE(OpLoad):
+            *sp++ = top;
+            top = slots[*ip++];
+            VM_NEXT();
+        VM_CASE(OpAdd):
+            top = *--sp + top;
+            VM_NEXT();
+        VM_CASE(OpSub):
+            top = *--sp - top;
+            VM_NEXT();
+        VM_CASE(OpMul):
+            top = *--sp * top;
+            VM_NEXT();
+        VM_CASE(OpDiv):
+            top = *--sp / top;
+            VM_NEXT();
+        VM_CASE(OpNeg):
+            top = -top;
+            VM_NEXT();
+        VM_CASE(OpReturn):
+            return top;
+#ifndef EVALEXP_COMPUTED_GOTO
+            default:
+                throw EvaluatorException("Incorrect syntax tree!");
+            }
+#endif
+        }
+#undef VM_CASE
+#undef VM_NEXT
+    }
+
+    double Evaluate(ASTNode* ast, const double* slots = NULL)
+    {
+        Program program;
+        Compiler().Compile(ast, program);
+
+        return Run(program, slots);
+    }
+};
@@ -0,0 +1,706 @@
+/*
+ * ConstExpr.h - Parses and evaluates expressions at compile time (C++14).
+ *
+ * Note: A formula that is fixed when the program is built does not need
+ *       Parser::Parse and the Evaluator at run time. The same EXP/TERM/
+ *       FACTOR grammar is implemented here with constexpr functions, which
+ *       the compiler runs on a string literal while compiling:
+ *
+ *        constexpr double v = ConstFold("(1+2)*(3+4)");       // 21
+ *
+ *       With variables, the expression becomes a type instead, with one
+ *       template instance per node, so that evaluating it is just the
+ *       arithmetic, fully inlined:
+ *
+ *        EVALEXP_CONSTEXPR(Poly, "x*x + 2*y");
+ *
+ *        double slots[] = { 3, 4 };        // x, y
+ *        double v = Poly::Evaluate(slots); // x*x + 2*y, no parsing left
+ *
+ *       The variables get their slots in the order they first appear, as
+ *       with a fresh SymbolTable; Poly::Slots says how many there are.
+ *
+ *       Both accept what Parser accepts, numbers come out bit for bit as
+ *       the Parser reads them, and the errors are those of the Parser:
+ *       ConstFold() fails to compile on a bad literal (and throws the same
+ *       ParserException as the Parser if called at run time), and
+ *       EVALEXP_CONSTEXPR stops, naming the error and its position, at the
+ *       instantiation of
+ *
+ *        ConstSyntaxError<error, position, symbol>
+ *
+ *       e.g. 'ConstSyntaxError<ConstUnexpectedToken, 4, '*'>' for "1 **2".
+ *
+ *       The numbers are those of fastfloat.h, of any length and with an
+ *       exponent, and are rounded the same, exactly; only slower, with
+ *       long division on big integers. An operation that overflows or
+ *       divides by zero, as in "1e308*10" or "1/0", is no constant
+ *       expression, though: ConstFold() fails to compile where the Parser
+ *       and the Evaluator give infinity.
+ */
+
+#ifndef CONSTEXPR_H
+#  define CONSTEXPR_H 1
+#endif
+
+#if __cplusplus < 201402L
+#  error "ConstExpr.h needs C++14 (relaxed constexpr)"
+#endif
+
+#include <limits>
+#include <string>
+#include <stdint.h>
+
+#ifndef PARSER_H
+#  include "Parser.h"
+#endif
+
+enum ConstErrorCode {
+    ConstNoError,
+    ConstUnexpectedToken,
+    ConstExpectedToken
+};
+
+// An unsigned integer of up to 4096 bits: enough for ConstToDouble() to
+// divide exactly with the 800 digits it keeps and any power of ten that a
+// double can need.
+struct ConstBig {
+    enum { Limbs = 128 };
+
+    uint32_t Limb[Limbs];
+    int      Size;                      // limbs in use; the rest are 0
+
+    constexpr ConstBig(uint32_t value = 0):
+        Limb(), Size(value != 0)
+    {
+        Limb[0] = value;
+    }
+
+    constexpr bool IsZero() const
+    {
+        return Size == 0;
+    }
+
+    constexpr int Bits() const
+    {
+        if(Size == 0)
+            return 0;
+
+        int bits = (Size - 1) * 32;
+        for(uint32_t top = Limb[Size - 1]; top != 0; top >>= 1)
+            bits++;
+        return bits;
+    }
+
+    // this = this * factor + addend
+    constexpr void MulAdd(uint32_t factor, uint32_t addend)
+    {
+        uint64_t carry = addend;
+        for(int i = 0; i < Size; i++) {
+            carry += (uint64_t)Limb[i] * factor;
+            Limb[i] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if(carry != 0)
+            Limb[Size++] = (uint32_t)carry;
+    }
+
+    constexpr ConstBig Shifted(int bits) const
+    {
+        ConstBig result;
+        if(Size == 0)
+            return result;
+
+        int limbs = bits / 32, shift = bits % 32;
+        for(int i = Size - 1; i >= 0; i--) {
+            uint64_t wide = (uint64_t)Limb[i] << shift;
+            result.Limb[i + limbs + 1] |= (uint32_t)(wide >> 32);
+            result.Limb[i + limbs] |= (uint32_t)wide;
+        }
+
+        result.Size = Size + limbs + 1;
+        while(result.Size > 0 && result.Limb[result.Size - 1] == 0)
+            result.Size--;
+        return result;
+    }
+
+    constexpr void Halve()
+    {
+        for(int i = 0; i < Size; i++)
+            Limb[i] = Limb[i] >> 1 | (i + 1 < Size ? Limb[i + 1] << 31 : 0);
+        if(Size > 0 && Limb[Size - 1] == 0)
+            Size--;
+    }
+
+    constexpr bool Less(const ConstBig& other) const
+    {
+        if(Size != other.Size)
+            return Size < other.Size;
+
+        for(int i = Size - 1; i >= 0; i--)
+            if(Limb[i] != other.Limb[i])
+                return Limb[i] < other.Limb[i];
+        return false;
+    }
+
+    // this = this - other, for other <= this.
+    constexpr void Subtract(const ConstBig& other)
+    {
+        uint64_t borrow = 0;
+        for(int i = 0; i < Size; i++) {
+            uint64_t sub = (uint64_t)(i < other.Size ? other.Limb[i] : 0) + borrow;
+            borrow = Limb[i] < sub;
+            Limb[i] = (uint32_t)(Limb[i] - sub);
+        }
+        while(Size > 0 && Limb[Size - 1] == 0)
+            Size--;
+    }
+};
+
+// The correctly rounded value of the 'length' characters at 'mantissa',
+// digits with at most one point, times 10^'exponent', as fastfloat.h reads
+// it for the Parser.
+constexpr double ConstToDouble(const char* mantissa, size_t length, long exponent)
+{
+    // Note: As in fastfloat.h, 800 significant digits are kept; if any of
+    //       the others is not 0, they become one more digit 1, which is
+    //       rounded the same.
+    const int kept = 800;
+
+    ConstBig n;
+    int digits = 0;
+    bool point = false, rest = false;
+
+    for(size_t i = 0; i < length; i++) {
+        char c = mantissa[i];
+        if(c == '.') {
+            point = true;
+            continue;
+        }
+
+        if(digits == 0 && c == '0') {
+            if(point)
+                exponent--;
+        }
+        else if(digits < kept) {
+            n.MulAdd(10, (uint32_t)(c - '0'));
+            digits++;
+            if(point)
+                exponent--;
+        }
+        else {
+            rest = rest || c != '0';
+            if(!point)
+                exponent++;
+        }
+    }
+
+    if(rest) {
+        n.MulAdd(10, 1);
+        digits++;
+        exponent--;
+    }
+
+    // The value is at least 10^(digits-1+exponent), and less than
+    // 10^(digits+exponent).
+    if(digits == 0 || digits + exponent <= -324)
+        return 0;
+    if(digits - 1 + exponent >= 309)
+        return std::numeric_limits<double>::infinity();
+
+    // Both operands exact, so the one rounding is correct (as in step 1
+    // of fastfloat.h).
+    uint64_t small = n.Size <= 2 ? (uint64_t)n.Limb[1] << 32 | n.Limb[0] : 0;
+    if(n.Size <= 2 && small <= ((uint64_t)1 << 53) && exponent >= -22 && exponent <= 22) {
+        double power = 1;
+        for(long i = 0; i < (exponent < 0 ? -exponent : exponent); i++)
+            power *= 10;
+        return exponent < 0 ? (double)small / power : (double)small * power;
+    }
+
+    ConstBig d(1);
+    for(long i = 0; i < exponent; i++)
+        n.MulAdd(10, 0);
+    for(long i = 0; i > exponent; i--)
+        d.MulAdd(10, 0);
+
+    // q = floor(n/d * 2^s) gets 54 or 55 bits, one more than a double
+    // holds, or fewer for a subnormal, whose last bit is 2^-1074.
+    int s = 54 + d.Bits() - n.Bits();
+    if(s > 1075)
+        s = 1075;
+
+    ConstBig a = s > 0 ? n.Shifted(s) : n;
+    ConstBig b = (s < 0 ? d.Shifted(-s) : d).Shifted(55);
+
+    uint64_t q = 0;
+    for(int i = 55; i >= 0; i--) {
+        if(!a.Less(b)) {
+            a.Subtract(b);
+            q |= (uint64_t)1 << i;
+        }
+        b.Halve();
+    }
+
+    bool sticky = !a.IsZero();
+    if(q >> 54 != 0) {
+        sticky = sticky || (q & 1) != 0;
+        q >>= 1;
+        s--;
+    }
+
+    // Round half to even; the value is then m * 2^(1-s).
+    bool guard = (q & 1) != 0;
+    uint64_t m = q >> 1;
+    if(guard && (sticky || (m & 1) != 0))
+        m++;
+
+    int exp2 = 1 - s, top = exp2 - 1;
+    for(uint64_t k = m; k != 0; k >>= 1)
+        top++;
+    if(top > 1023)
+        return std::numeric_limits<double>::infinity();
+
+    double value = (double)m;
+    for(; exp2 > 0; exp2--)
+        value *= 2;
+    for(; exp2 < 0; exp2++)
+        value /= 2;
+
+    return value;
+}
+
+// The parsed form of a literal: the nodes in postfix order, as in
+// PostfixExpression, plus the first error, if any.
+template<size_t N>
+struct ConstProgram {
+    uint8_t         Op[N];
+    uint32_t        Left[N];
+    uint32_t        Right[N];
+    double          Constants[N];
+    size_t          NameBegin[N];       // where each slot's name is
+    size_t          NameLength[N];
+    size_t          Count;
+    size_t          ConstantCount;
+    size_t          Slots;
+    ConstErrorCode  Error;
+    size_t          Position;
+    char            Symbol;
+
+    constexpr ConstProgram():
+        Op(), Left(), Right(), Constants(), NameBegin(), NameLength(),
+        Count(0), ConstantCount(0), Slots(0),
+        Error(ConstNoError), Position(0), Symbol(0)
+    {
+    }
+
+    constexpr double Evaluate(const double* slots) const
+    {
+        double values[N] = {};
+
+        for(size_t i = 0; i < Count; i++) {
+            switch(Op[i]) {
+            case NumberValue:   values[i] = Constants[Left[i]]; break;
+            case Variable:      values[i] = slots[Left[i]]; break;
+            case UnaryMinus:    values[i] = -values[Left[i]]; break;
+            case OperatorPlus:  values[i] = values[Left[i]] + values[Right[i]]; break;
+            case OperatorMinus: values[i] = values[Left[i]] - values[Right[i]]; break;
+            case OperatorMul:   values[i] = values[Left[i]] * values[Right[i]]; break;
+            case OperatorDiv:   values[i] = values[Left[i]] / values[Right[i]]; break;
+            }
+        }
+
+        return values[Count - 1];
+    }
+
+    std::string Message() const;
+};
+
+// The text of the ParserException the Parser would throw.
+inline std::string ConstErrorMessage(ConstErrorCode error, size_t position, char symbol)
+{
+    std::string at = " at position " + std::to_string(position);
+
+    switch(error) {
+    case ConstUnexpectedToken:
+        if(symbol == 0)
+            return "Unexpected end of text" + at;
+        return std::string("Unexpected token '") + symbol + "'" + at;
+    case ConstExpectedToken:
+        return std::string("Expected token '") + symbol + "'" + at;
+    default:
+        return "";
+    }
+}
+
+template<size_t N>
+std::string ConstProgram<N>::Message() const
+{
+    return ConstErrorMessage(Error, Position, Symbol);
+}
+
+// Note: The recursive descent of the original Parser, with the same tokens,
+//       the same checks and the same error positions. The first error is
+//       kept, and everything after it returns straight away.
+template<size_t N>
+class ConstParser
+{
+    const char*     m_Text;
+    size_t          m_Index;
+    bool            m_Variables;
+    TokenType       m_Type;
+    double          m_Value;
+    char            m_Symbol;
+    uint32_t        m_Slot;
+    ConstProgram<N> m_Program;
+
+    static constexpr bool IsSpace(char c)
+    {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    static constexpr bool IsDigit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    static constexpr bool IsIdentifierStart(char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+    }
+
+    constexpr bool Failed() const
+    {
+        return m_Program.Error != ConstNoError;
+    }
+
+    constexpr void Fail(ConstErrorCode error, char symbol)
+    {
+        if(Failed())
+            return;
+
+        m_Program.Error = error;
+        m_Program.Position = m_Index;
+        m_Program.Symbol = symbol;
+    }
+
+    constexpr uint32_t Append(ASTNodeType op, uint32_t left, uint32_t right)
+    {
+        if(Failed() || m_Program.Count == N)
+            return 0;
+
+        size_t i = m_Program.Count++;
+        m_Program.Op[i] = (uint8_t)op;
+        m_Program.Left[i] = left;
+        m_Program.Right[i] = right;
+
+        return (uint32_t)i;
+    }
+
+    constexpr uint32_t Declare(size_t begin, size_t length)
+    {
+        for(size_t slot = 0; slot < m_Program.Slots; slot++) {
+            if(m_Program.NameLength[slot] != length)
+                continue;
+
+            size_t k = 0;
+            while(k < length && m_Text[m_Program.NameBegin[slot] + k] == m_Text[begin + k])
+                k++;
+            if(k == length)
+                return (uint32_t)slot;
+        }
+
+        m_Program.NameBegin[m_Program.Slots] = begin;
+        m_Program.NameLength[m_Program.Slots] = length;
+
+        return (uint32_t)m_Program.Slots++;
+    }
+
+    constexpr void GetNextToken()
+    {
+        while(IsSpace(m_Text[m_Index])) m_Index++;
+
+        m_Value = 0;
+        m_Symbol = 0;
+
+        char c = m_Text[m_Index];
+
+        if(c == 0) {
+            m_Type = EndOfText;
+            return;
+        }
+
+        if(IsDigit(c)) {
+            size_t index = m_Index;
+            while(IsDigit(m_Text[m_Index])) m_Index++;
+            if(m_Text[m_Index] == '.') m_Index++;
+            while(IsDigit(m_Text[m_Index])) m_Index++;
+            size_t length = m_Index - index;
+
+            // As in fastfloat.h, the 'e' is only part of the number if
+            // digits follow, and the exponent is clamped.
+            long exponent = 0;
+            if(m_Text[m_Index] == 'e' || m_Text[m_Index] == 'E') {
+                size_t j = m_Index + 1;
+                bool negative = false;
+                if(m_Text[j] == '+' || m_Text[j] == '-')
+                    negative = m_Text[j++] == '-';
+
+                if(IsDigit(m_Text[j])) {
+                    for(; IsDigit(m_Text[j]); j++)
+                        if(exponent < 100000)
+                            exponent = exponent * 10 + (m_Text[j] - '0');
+                    if(exponent > 100000)
+                        exponent = 100000;
+                    if(negative)
+                        exponent = -exponent;
+                    m_Index = j;
+                }
+            }
+
+            m_Type = Number;
+            m_Value = ConstToDouble(m_Text + index, length, exponent);
+            return;
+        }
+
+        if(m_Variables && IsIdentifierStart(c)) {
+            size_t index = m_Index;
+            while(IsIdentifierStart(m_Text[m_Index]) || IsDigit(m_Text[m_Index])) m_Index++;
+
+            m_Type = Identifier;
+            m_Symbol = c;
+            m_Slot = Declare(index, m_Index - index);
+            return;
+        }
+
+        m_Type = Error;
+
+        switch(c) {
+        case '+': m_Type = Plus; break;
+        case '-': m_Type = Minus; break;
+        case '*': m_Type = Mul; break;
+        case '/': m_Type = Div; break;
+        case '(': m_Type = OpenParenthesis; break;
+        case ')': m_Type = ClosedParenthesis; break;
+        }
+
+        if(m_Type != Error) {
+            m_Symbol = c;
+            m_Index++;
+        }
+        else
+            Fail(ConstUnexpectedToken, c);
+    }
+
+    constexpr void Match(char expected)
+    {
+        if(m_Text[m_Index-1] == expected)
+            GetNextToken();
+        else
+            Fail(ConstExpectedToken, expected);
+    }
+
+    constexpr uint32_t Expression()
+    {
+        uint32_t node = Term();
+
+        while(!Failed() && (m_Type == Plus || m_Type == Minus)) {
+            ASTNodeType op = m_Type == Plus ? OperatorPlus : OperatorMinus;
+            GetNextToken();
+            uint32_t right = Term();
+            node = Append(op, node, right);
+        }
+
+        return node;
+    }
+
+    constexpr uint32_t Term()
+    {
+        uint32_t node = Factor();
+
+        while(!Failed() && (m_Type == Mul || m_Type == Div)) {
+            ASTNodeType op = m_Type == Mul ? OperatorMul : OperatorDiv;
+            GetNextToken();
+            uint32_t right = Factor();
+            node = Append(op, node, right);
+        }
+
+        return node;
+    }
+
+    constexpr uint32_t Factor()
+    {
+        if(Failed())
+            return 0;
+
+        switch(m_Type) {
+        case OpenParenthesis: {
+            GetNextToken();
+            uint32_t node = Expression();
+            Match(')');
+            return node;
+        }
+
+        case Minus: {
+            GetNextToken();
+            uint32_t node = Factor();
+            return Append(UnaryMinus, node, 0);
+        }
+
+        case Number: {
+            if(m_Program.ConstantCount == N)
+                return 0;
+            size_t constant = m_Program.ConstantCount++;
+            m_Program.Constants[constant] = m_Value;
+            GetNextToken();
+            return Append(NumberValue, (uint32_t)constant, 0);
+        }
+
+        case Identifier: {
+            uint32_t slot = m_Slot;
+            GetNextToken();
+            return Append(::Variable, slot, 0);
+        }
+
+        default:
+            Fail(ConstUnexpectedToken, m_Symbol);
+            return 0;
+        }
+    }
+
+public:
+    constexpr ConstParser(const char* text, bool variables):
+        m_Text(text), m_Index(0), m_Variables(variables),
+        m_Type(Error), m_Value(0), m_Symbol(0), m_Slot(0), m_Program()
+    {
+    }
+
+    constexpr ConstProgram<N> Parse()
+    {
+        GetNextToken();
+        Expression();
+
+        return m_Program;
+    }
+};
+
+// 'N' must be more than the length of the text; every node takes at least
+// one character.
+template<size_t N>
+constexpr ConstProgram<N> ConstParse(const char* text, bool variables)
+{
+    return ConstParser<N>(text, variables).Parse();
+}
+
+constexpr size_t ConstLength(const char* text)
+{
+    size_t length = 0;
+    while(text[length] != 0)
+        length++;
+
+    return length;
+}
+
+// The value of a literal without variables.
+template<size_t N>
+constexpr double ConstFold(const char (&text)[N])
+{
+    ConstProgram<N> program = ConstParse<N>(text, false);
+    if(program.Error != ConstNoError)
+        throw ParserException(program.Message(), (int)program.Position);
+
+    return program.Evaluate(NULL);
+}
+
+// A compile error naming the first syntax error, and where it is.
+template<ConstErrorCode Error, size_t Position, char Symbol>
+struct ConstSyntaxError {
+    static_assert(Error == ConstNoError,
+                  "Syntax error in a constant expression; see the ConstSyntaxError "
+                  "<error, position, symbol> being instantiated");
+};
+
+// One node of a ConstExpression, by its index in Expr::Code.
+template<class Expr, size_t I, int Op = Expr::Code.Op[I]>
+struct ConstNode {
+    // Undefined: only after a syntax error, already reported.
+    static constexpr double Evaluate(const double*)
+    {
+        return 0;
+    }
+};
+
+template<class Expr, size_t I>
+struct ConstNode<Expr, I, NumberValue> {
+    static constexpr double Evaluate(const double*)
+    {
+        return Expr::Code.Constants[Expr::Code.Left[I]];
+    }
+};
+
+template<class Expr, size_t I>
+struct ConstNode<Expr, I, Variable> {
+    static constexpr double Evaluate(const double* slots)
+    {
+        return slots[Expr::Code.Left[I]];
+    }
+};
+
+template<class Expr, size_t I>
+struct ConstNode<Expr, I, UnaryMinus> {
+    static constexpr double Evaluate(const double* slots)
+    {
+        return -ConstNode<Expr, Expr::Code.Left[I]>::Evaluate(slots);
+    }
+};
+
+#define EVALEXP_CONST_BINARY(type, op)                                      \
+    template<class Expr, size_t I>                                          \
+    struct ConstNode<Expr, I, type> {                                       \
+        static constexpr double Evaluate(const double* slots)               \
+        {                                                                   \
+            return ConstNode<Expr, Expr::Code.Left[I]>::Evaluate(slots)     \
+                op ConstNode<Expr, Expr::Code.Right[I]>::Evaluate(slots);   \
+        }                                                                   \
+    };
+
+EVALEXP_CONST_BINARY(OperatorPlus, +)
+EVALEXP_CONST_BINARY(OperatorMinus, -)
+EVALEXP_CONST_BINARY(OperatorMul, *)
+EVALEXP_CONST_BINARY(OperatorDiv, /)
+
+#undef EVALEXP_CONST_BINARY
+
+// 'Source' provides 'static constexpr const char* Text()'; see
+// EVALEXP_CONSTEXPR below.
+template<class Source>
+class ConstExpression
+{
+public:
+    enum : size_t { Capacity = ConstLength(Source::Text()) + 1 };
+
+    static constexpr ConstProgram<Capacity> Code = ConstParse<Capacity>(Source::Text(), true);
+
+    enum : size_t {
+        Checked = sizeof(ConstSyntaxError<Code.Error, Code.Position, Code.Symbol>),
+        Root = Code.Count == 0 ? 0 : Code.Count - 1,
+        Slots = Code.Slots
+    };
+
+    // 'slots' may be NULL if there are no variables.
+    static constexpr double Evaluate(const double* slots = NULL)
+    {
+        return ConstNode<ConstExpression, Root>::Evaluate(slots);
+    }
+};
+
+template<class Source>
+constexpr ConstProgram<ConstExpression<Source>::Capacity> ConstExpression<Source>::Code;
+
+// Declares the type 'name' for the expression 'text', at namespace or
+// class scope.
+#define EVALEXP_CONSTEXPR(name, text)                                       \
+    struct name##Source {                                                   \
+        static constexpr const char* Text() { return text; }                \
+    };                                                                      \
+    typedef ConstExpression<name##Source> name
@@ -0,0 +1,226 @@
+/*
+ * Dag.h - Stores each distinct subexpression once, as a DAG in postfix form.
+ *
+ * Note: A formula often repeats itself, as in '(a+b)*(a+b)/(a+b)'. The
+ *       DagBuilder hashes every node it is asked for on its operator and
+ *       operands and, if the same node was built before, returns that one
+ *       instead of appending a copy. Since the operands are nodes that were
+ *       already shared, equal subtrees of any size end up as one node:
+ *
+ *        index   Op      Left  Right          Constants
+ *        ---------------------------          ---------
+ *         0      VAR     0  (a)
+ *         1      VAR     1  (b)
+ *         2      +       0     1
+ *         3      *       2     2
+ *         4      /       3     2
+ *
+ *       Nodes still only refer to nodes before them and the root is still
+ *       the last one, so this is an ordinary PostfixExpression: the
+ *       Evaluator and the BatchEvaluator run it as is, and compute each
+ *       shared node once per evaluation.
+ *
+ *       Sharing is exact: two nodes are merged only if they compute the
+ *       same double for every input, bit for bit. So constants are compared
+ *       by their bits (0 and -0 stay apart) and 'a+b' and 'b+a' stay apart,
+ *       since of two NaNs the sum keeps the payload of the first.
+ *
+ *       To share an existing tree, hand it to the builder with Flatten():
+ *
+ *        PostfixExpression dag;
+ *        DagBuilder builder(&dag);
+ *        Flatten(ast, builder);
+ */
+
+#ifndef DAG_H
+#  define DAG_H 1
+#endif
+
+#include <string.h>
+
+#ifndef POSTFIX_H
+#  include "Postfix.h"
+#endif
+
+// DagBuilder - like PostfixBuilder, but appends each distinct node once.
+class DagBuilder
+{
+public:
+    // TreeNodes is the number of nodes asked for, i.e. the size of the tree;
+    // DagNodes the number actually stored. The bytes are those of the tree
+    // as ASTNodes, as a PostfixExpression without sharing, and as the DAG.
+    struct Statistics {
+        size_t TreeNodes;
+        size_t DagNodes;
+        size_t TreeBytes;
+        size_t FlatBytes;
+        size_t DagBytes;
+
+        size_t Duplicates() const
+        {
+            return TreeNodes - DagNodes;
+        }
+    };
+
+private:
+    PostfixExpression*    m_Expr;
+    std::vector<uint32_t> m_Table;      // node index + 1, 0 when empty
+    size_t                m_Requested;
+    size_t                m_Numbers;
+
+    static uint64_t Bits(double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    static size_t Hash(unsigned op, uint64_t left, uint32_t right)
+    {
+        uint64_t h = (left + op) * 0x9E3779B97F4A7C15ULL;
+        h ^= (h >> 29) ^ ((right + 1) * 0xC2B2AE3D27D4EB4FULL);
+        return (size_t)(h ^ (h >> 32));
+    }
+
+    // Note: For NumberValue, the node's own Left is only its place in the
+    //       constant pool, so the value's bits stand in for it.
+    uint64_t LeftKey(const PostfixNode& node) const
+    {
+        return node.Op == NumberValue ? Bits(m_Expr->Constants[node.Left]) : node.Left;
+    }
+
+    void Rehash(size_t size)
+    {
+        std::vector<uint32_t> table(size, 0);
+        size_t mask = table.size() - 1;
+
+        for(size_t i = 0; i < m_Expr->Nodes.size(); i++) {
+            const PostfixNode& node = m_Expr->Nodes[i];
+            size_t slot = Hash(node.Op, LeftKey(node), node.Right) & mask;
+            while(table[slot] != 0)
+                slot = (slot + 1) & mask;
+            table[slot] = (uint32_t)i + 1;
+        }
+
+        m_Table.swap(table);
+    }
+
+    uint32_t Intern(ASTNodeType op, uint64_t left, uint32_t right, double value)
+    {
+        m_Requested++;
+
+        if(2 * (m_Expr->Nodes.size() + 1) > m_Table.size())
+            Rehash(m_Table.empty() ? 64 : m_Table.size() * 2);
+
+        size_t mask = m_Table.size() - 1;
+        size_t slot = Hash(op, left, right) & mask;
+
+        for(; m_Table[slot] != 0; slot = (slot + 1) & mask) {
+            const PostfixNode& node = m_Expr->Nodes[m_Table[slot] - 1];
+            if(node.Op == op && node.Right == right && LeftKey(node) == left)
+                return m_Table[slot] - 1;
+        }
+
+        PostfixNode node;
+        node.Op = (uint8_t)op;
+        node.Left = (uint32_t)left;
+        node.Right = right;
+
+        if(op == NumberValue) {
+            node.Left = (uint32_t)m_Expr->Constants.size();
+            m_Expr->Constants.push_back(value);
+        }
+
+        m_Expr->Nodes.push_back(node);
+        m_Table[slot] = (uint32_t)m_Expr->Nodes.size();
+
+        return (uint32_t)m_Expr->Nodes.size() - 1;
+    }
+
+public:
+    typedef uint32_t Node;
+
+    DagBuilder(PostfixExpression* expr = NULL):
+        m_Expr(expr), m_Requested(0), m_Numbers(0)
+    {
+    }
+
+    void Begin()
+    {
+        m_Expr->Clear();
+        m_Table.assign(m_Table.size(), 0);
+        m_Requested = 0;
+        m_Numbers = 0;
+    }
+
+    // Note: As with PostfixBuilder, the nodes of a failed parse stay until
+    //       the next Begin().
+    void Discard(Node)
+    {
+    }
+
+    Node Binary(ASTNodeType type, Node left, Node right)
+    {
+        return Intern(type, left, right, 0);
+    }
+
+    Node Unary(Node left)
+    {
+        return Intern(UnaryMinus, left, 0, 0);
+    }
+
+    Node Number(double value)
+    {
+        m_Numbers++;
+        return Intern(NumberValue, Bits(value), 0, value);
+    }
+
+    Node Variable(unsigned slot)
+    {
+        return Intern(::Variable, slot, 0, 0);
+    }
+
+    // What has been built so far, to go back to with Rollback().
+    struct Mark {
+        size_t Nodes;
+        size_t Constants;
+        size_t Requested;
+        size_t Numbers;
+    };
+
+    Mark GetMark() const
+    {
+        Mark mark = { m_Expr->Nodes.size(), m_Expr->Constants.size(), m_Requested, m_Numbers };
+        return mark;
+    }
+
+    // Drops every node built since 'mark', e.g. those of a failed parse.
+    void Rollback(const Mark& mark)
+    {
+        m_Expr->Nodes.resize(mark.Nodes);
+        m_Expr->Constants.resize(mark.Constants);
+        m_Requested = mark.Requested;
+        m_Numbers = mark.Numbers;
+
+        if(!m_Table.empty())
+            Rehash(m_Table.size());
+    }
+
+    // For the expression built since the last Begin().
+    Statistics GetStatistics() const
+    {
+        Statistics stats;
+        stats.TreeNodes = m_Requested;
+        stats.DagNodes = m_Expr->Nodes.size();
+        stats.TreeBytes = m_Requested * sizeof(ASTNode);
+        stats.FlatBytes = m_Requested * sizeof(PostfixNode) + m_Numbers * sizeof(double);
+        stats.DagBytes = m_Expr->Nodes.size() * sizeof(PostfixNode)
+                       + m_Expr->Constants.size() * sizeof(double);
+        return stats;
+    }
+};
+
+// Usage: 'DagParser parser(&expr); parser.Parse(text);' fills 'expr' and
+//        returns the index of its root; GetBuilder().GetStatistics() tells
+//        how much was shared.
+typedef BasicParser<DagBuilder> DagParser;
@@ -1,7 +1,20 @@
 #include "Parser.h"
 #include "Evaluator.h"
+#include "Optimizer.h"
+#include "BatchEvaluator.h"
+#include "ParallelEvaluator.h"
+#include "ValueParser.h"
+#include "Validator.h"
+#include "ExpressionSet.h"
+#if __cplusplus >= 201402L
+#  include "ConstExpr.h"
+#endif
 #include <iostream>
+#include <string>
+#include <vector>
 #include <typeinfo>
+#include <limits>
+#include <random>
 #include <stdio.h>
 #include <string.h>
 
@@ -33,6 +46,298 @@ void Test(const char* text)
     }
 }
 
+size_t CountNodes(ASTNode* ast)
+{
+    if(ast == NULL)
+        return 0;
+
+    return 1 + CountNodes(ast->Left) + CountNodes(ast->Right);
+}
+
+// One node per number and per operator, no neutral elements.
+void TestNodeCount(const char* text, size_t expected)
+{
+    Parser parser;
+    ASTNode* ast = parser.Parse(text);
+    size_t count = CountNodes(ast);
+
+    std::cout << text << " \t " << count << " nodes"
+              << (count == expected ? "" : " (FAILED)") << std::endl;
+
+    delete ast;
+}
+
+// The exact bits of the result, since '%g' hides the last digits and the
+// sign of a zero.
+void TestBits(const char* text, unsigned long long expected)
+{
+    Parser parser;
+    ASTNode* ast = parser.Parse(text);
+    double val = Evaluator().Evaluate(ast);
+    unsigned long long bits;
+    memcpy(&bits, &val, sizeof(double));
+
+    printf("%s \t 0x%016llx%s\n", text, bits, bits == expected ? "" : " (FAILED)");
+
+    delete ast;
+}
+
+// Note: 'x' and 'y' are declared up front, so they get slots 0 and 1 no
+//       matter in which order the expression uses them.
+void TestVariables(const char* text, double x, double y)
+{
+    SymbolTable symbols;
+    symbols.Declare("x");
+    symbols.Declare("y");
+
+    Parser parser(NULL, &symbols);
+
+    try 
+    {
+        ASTNode* ast = parser.Parse(text);
+
+        try 
+        {
+            double slots[] = { x, y };
+
+            Evaluator eval;
+            double val = eval.Evaluate(ast, slots);
+
+            std::cout << text << " [x=" << x << ", y=" << y << "] = " << val << std::endl;
+        }
+        catch(EvaluatorException& ex)
+        {
+            std::cout << text << " \t " << ex.what() << std::endl; 
+        }
+
+        delete ast;
+    }
+    catch(ParserException& ex)
+    {
+        std::cout << text << " \t " << ex.what() << std::endl; 
+    }
+}
+
+// Evaluating while parsing has to give the value of the tree.
+void TestDirect(const char* text)
+{
+    Parser parser;
+    ASTNode* ast = parser.Parse(text);
+    double val = Evaluator().Evaluate(ast);
+    double direct = ValueParser().Evaluate(text);
+
+    std::cout << text << " = " << direct << " (direct)"
+              << (memcmp(&val, &direct, sizeof(double)) == 0 ? "" : " (FAILED)") << std::endl;
+
+    delete ast;
+}
+
+// The strict Optimizer's tree has to give the original's values, bit for
+// bit, for every pair of special inputs as x and y. Only when both are
+// NaNs, which one comes out is up to the compiler (see Optimizer.h).
+void TestOptimizer(const char* text)
+{
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const double inf = std::numeric_limits<double>::infinity();
+    const double inputs[] = {
+        0.0, -0.0, 1, -1, 3, 0.1, -2.5e-310, 4.9406564584124654e-324,
+        1.7976931348623157e308, inf, -inf, nan, -nan
+    };
+    const size_t count = sizeof(inputs) / sizeof(inputs[0]);
+
+    SymbolTable symbols;
+    symbols.Declare("x");
+    symbols.Declare("y");
+
+    Parser parser(NULL, &symbols);
+    ASTNode* original = parser.Parse(text);
+    ASTNode* optimized = Optimizer().Optimize(parser.Parse(text));
+
+    Evaluator eval;
+    size_t same = 0;
+    for(size_t i = 0; i < count; i++) {
+        for(size_t j = 0; j < count; j++) {
+            double slots[] = { inputs[i], inputs[j] };
+            double v1 = eval.Evaluate(original, slots);
+            double v2 = eval.Evaluate(optimized, slots);
+            if(memcmp(&v1, &v2, sizeof(double)) == 0
+               || (slots[0] != slots[0] && slots[1] != slots[1] && v1 != v1 && v2 != v2))
+                same++;
+        }
+    }
+
+    std::cout << text << " \t " << same << "/" << count * count << " inputs (optimized)"
+              << (same == count * count ? "" : " (FAILED)") << std::endl;
+
+    delete original;
+    delete optimized;
+}
+
+// A random tree of + - * /, unary minus, small integers and x, about
+// 2^depth leaves.
+void GenerateTree(std::mt19937& random, int depth, std::string& text)
+{
+    if(depth == 0 || random() % 8 == 0) {
+        if(random() % 2)
+            text += 'x';
+        else
+            text += (char)('0' + random() % 10);
+        return;
+    }
+
+    if(random() % 16 == 0) {
+        text += "-(";
+        GenerateTree(random, depth - 1, text);
+        text += ')';
+        return;
+    }
+
+    text += '(';
+    GenerateTree(random, depth - 1, text);
+    text += "+-*/"[random() % 4];
+    GenerateTree(random, depth - 1, text);
+    text += ')';
+}
+
+// Forking the tree over threads has to give the Evaluator's value, bit
+// for bit, but for the sign of a NaN (see ParallelEvaluator.h).
+void TestParallel(int depth, unsigned threads)
+{
+    std::mt19937 random(depth);
+    std::string text;
+    GenerateTree(random, depth, text);
+
+    SymbolTable symbols;
+    symbols.Declare("x");
+    ASTNode* ast = Parser(NULL, &symbols).Parse(text.c_str());
+
+    const double inputs[] = { 0.0, -0.0, 0.5, -3, 1e300,
+                              std::numeric_limits<double>::quiet_NaN() };
+    const size_t count = sizeof(inputs) / sizeof(inputs[0]);
+
+    ParallelEvaluator parallel(threads, 1024);
+    Evaluator eval;
+    size_t same = 0;
+    for(size_t i = 0; i < count; i++) {
+        double v1 = eval.Evaluate(ast, &inputs[i]);
+        double v2 = parallel.Evaluate(ast, &inputs[i]);
+        if(memcmp(&v1, &v2, sizeof(double)) == 0 || (v1 != v1 && v2 != v2))
+            same++;
+    }
+
+    std::cout << "tree(" << ASTNode::SubtreeSize(ast) << " nodes) \t " << same << "/" << count
+              << " inputs (" << threads << " threads)"
+              << (same == count ? "" : " (FAILED)") << std::endl;
+
+    delete ast;
+}
+
+// ParseStrict() has to report 'expected' (or "No error"), and the Validator
+// the same error at the same position.
+void TestStrict(const char* text, const char* expected)
+{
+    Parser parser;
+    ErrorInfo error;
+    delete parser.ParseStrict(text, error);
+
+    ErrorInfo checked;
+    Validator().Validate(text, checked);
+
+    bool same = error.Message() == expected && checked.Code == error.Code
+                && checked.Position == error.Position && checked.Symbol == error.Symbol;
+
+    std::cout << text << " \t " << error.Message() << (same ? "" : " (FAILED)") << std::endl;
+}
+
+// With a symbol table, the Validator accepts names but declares nothing.
+void TestValidateNames(const char* text)
+{
+    SymbolTable symbols;
+    symbols.Declare("x");
+
+    ErrorInfo error;
+    bool valid = Validator(&symbols).Validate(text, error);
+
+    std::cout << text << " \t " << error.Message() << " (" << symbols.Size() << " symbol)"
+              << (valid && symbols.Size() == 1 ? "" : " (FAILED)") << std::endl;
+}
+
+// A formula that fails to parse, in full, must leave the set and the
+// symbol table as they were.
+void TestSetAdd(const char* text)
+{
+    SymbolTable symbols;
+    symbols.Declare("x");
+    ExpressionSet set(&symbols);
+    set.Add("x*2");
+
+    std::string message = "No error";
+    try
+    {
+        set.Add(text);
+    }
+    catch(ParserException& ex)
+    {
+        message = ex.what();
+    }
+
+    std::cout << text << " \t " << message << " (" << set.Size() << " formula, "
+              << symbols.Size() << " symbol)"
+              << (set.Size() == 1 && symbols.Size() == 1 ? "" : " (FAILED)") << std::endl;
+}
+
+// "x+1-x*2/x+3-..." with the given number of terms; the batch has to give
+// the Evaluator's values with at most 'columns' scratch columns.
+void TestBatchScratch(int terms, size_t columns)
+{
+    static const char ops[] = "+-*/";
+
+    std::string text = "x";
+    for(int i = 1; i < terms; i++) {
+        text += ops[i % 4];
+        text += i % 2 ? "x" : std::to_string(i % 9 + 1);
+    }
+
+    SymbolTable symbols;
+    symbols.Declare("x");
+    PostfixExpression expr;
+    PostfixParser(&expr, &symbols).Parse(text.c_str());
+
+    const size_t rows = 1000;
+    std::vector<double> xs(rows), results(rows);
+    for(size_t i = 0; i < rows; i++)
+        xs[i] = i * 0.25 - 100;
+    const double* inputs[] = { &xs[0] };
+
+    BatchEvaluator batch;
+    batch.Evaluate(expr, inputs, rows, &results[0]);
+
+    Evaluator eval;
+    bool same = true;
+    for(size_t i = 0; i < rows; i++) {
+        double val = eval.Evaluate(expr, &xs[i]);
+        same = same && memcmp(&val, &results[i], sizeof(double)) == 0;
+    }
+
+    std::cout << "chain(" << terms << ") \t " << batch.ScratchColumns() << " scratch columns"
+              << (same && batch.ScratchColumns() <= columns ? "" : " (FAILED)") << std::endl;
+}
+
+#if __cplusplus >= 201402L
+// The value folded while compiling has to be the one parsed at run time.
+#define TestConstFold(text)                                                 \
+    do {                                                                    \
+        constexpr double folded = ConstFold(text);                          \
+        Parser parser;                                                      \
+        ASTNode* ast = parser.Parse(text);                                  \
+        double val = Evaluator().Evaluate(ast);                             \
+        std::cout << text << " = " << folded << " (constexpr)"              \
+                  << (memcmp(&val, &folded, sizeof(double)) == 0 ? "" : " (FAILED)") \
+                  << std::endl;                                             \
+        delete ast;                                                         \
+    } while(0)
+#endif
+
 int main()
 {
     Test("1+2+3+4");
@@ -58,5 +363,60 @@ int main()
     Test("1 ** 2.5");
     Test("*1 / 2.5");
 
+    TestNodeCount("125", 1);
+    TestNodeCount("-1", 2);
+    TestNodeCount("1+2*3", 5);
+    TestNodeCount("1-2-3-4", 7);
+    TestNodeCount("(1+2)*(3+4)", 7);
+    TestNodeCount("-1+(-2.0)", 5);
+
+    TestBits("92/3", 0x403eaaaaaaaaaaabULL);
+    TestBits("7/5", 0x3ff6666666666666ULL);
+    TestBits("1/2/3/4", 0x3fa5555555555555ULL);
+    TestBits("-0", 0x8000000000000000ULL);
+    TestBits("-6*0", 0x8000000000000000ULL);
+    TestBits("-0/93", 0x8000000000000000ULL);
+
+    TestVariables("x*x + 2*y", 3, 4);
+    TestVariables("(y - x) / -x", 2, 7);
+
+    TestDirect("1+(2*3)/4+5");
+    TestDirect("-(1-2-3)/7*0.1");
+
+    TestOptimizer("x*1 + 1*y - (2*3 - 6)");
+    TestOptimizer("x/1 - 0 + (y + -0)");
+    TestOptimizer("--x / -(-y)");
+    TestOptimizer("x/4 + y/0.5 - x/1024/2");
+    TestOptimizer("(x/8)*(1+1) / (y/0.125)");
+    TestOptimizer("0*x + (x-x)/(0-0)");
+
+    TestStrict("(1+2)*-3", "No error");
+    TestStrict("1 2", "Unexpected token '2' at position 2");
+    TestStrict("1+2)", "Unexpected token ')' at position 3");
+    TestStrict("((1)", "Expected token ')' at position 4");
+    TestStrict("(1+2", "Expected token ')' at position 4");
+    TestStrict("1+", "Unexpected end of text at position 2");
+    TestStrict("", "Unexpected end of text at position 0");
+    TestStrict("1 + 2&5", "Unexpected token '&' at position 5");
+    TestStrict("1 ** 2", "Unexpected token '*' at position 4");
+
+    TestValidateNames("x*y + z");
+
+    TestSetAdd("x+1)");
+    TestSetAdd("foo*bar+");
+
+    TestBatchScratch(100000, 2 + 9);
+    TestParallel(20, 4);    // two for the chain, one per digit
+
+#if __cplusplus >= 201402L
+    TestConstFold("1+(2*3)/4+5");
+    TestConstFold("-1+(-2.0)");
+    TestConstFold("0.1*3 - 12345678901234567.89");
+    TestConstFold("2.5e2 + 1E-3*7");
+    TestConstFold("1234567890123456789012345678901234567890.5e-20");
+    TestConstFold("4.9406564584124654e-324 + 2.2250738585072011e-308");
+    TestConstFold("1.7976931348623159e308 + 1e400");
+#endif
+
     return 0;
 }
@@ -1,48 +1,248 @@
-#ifndef AST_H
-#  include "AST.h"
-#endif
-
-class EvaluatorException : public std::runtime_error
-{
-public:
-EvaluatorException(const std::string& message):
-    std::runtime_error(message.c_str())
-    {
-    }
-};
-
-class Evaluator 
-{
-    double EvaluateSubtree(ASTNode* ast)
-    {
-        if(ast == NULL) 
-            throw EvaluatorException("Incorrect syntax tree!");
-
-        if(ast->Type == NumberValue)
-            return ast->Value;
-        else if(ast->Type == UnaryMinus)
-            return -EvaluateSubtree(ast->Left);
-        else 
-        {
-            double v1 = EvaluateSubtree(ast->Left);
-            double v2 = EvaluateSubtree(ast->Right);
-            switch(ast->Type) {
-            case OperatorPlus:  return v1 + v2;
-            case OperatorMinus: return v1 - v2;
-            case OperatorMul:   return v1 * v2;
-            case OperatorDiv:   return v1 / v2;
-            }
-        }
-
-        throw EvaluatorException("Incorrect syntax tree!");
-    }
-
-public:
-    double Evaluate(ASTNode* ast)
-    {
-        if(ast == NULL)
-            throw EvaluatorException("Incorrect abstract syntax tree");
-
-        return EvaluateSubtree(ast);
-    }
-};
+#ifndef EVALUATOR_H
+#  define EVALUATOR_H 1
+#endif
+
+#ifndef AST_H
+#  include "AST.h"
+#endif
+
+#ifndef POSTFIX_H
+#  include "Postfix.h"
+#endif
+
+class EvaluatorException : public std::runtime_error
+{
+public:
+EvaluatorException(const std::string& message):
+    std::runtime_error(message.c_str())
+    {
+    }
+};
+
+class Evaluator 
+{
+public:
+    // Recursive:     one native call per tree level; the fastest for the
+    //                usual, shallow trees.
+    // ExplicitStack: keeps the traversal on the heap, so any depth works.
+    // Auto:          recursive for the first MaxRecursion levels, and with
+    //                the explicit stack for whatever lies below them.
+    enum Mode {
+        Recursive,
+        ExplicitStack,
+        Auto
+    };
+
+    enum { MaxRecursion = 2048 };
+
+private:
+    struct Frame {
+        ASTNode* Node;
+        int      State;     // how many children are done
+    };
+
+    Mode m_Mode;
+    size_t m_RecursionLimit;
+    std::vector<double> m_Values;
+    std::vector<Frame> m_Frames;
+    const double* m_Slots;
+
+    double Lookup(unsigned slot)
+    {
+        if(m_Slots == NULL)
+            throw EvaluatorException("No values given for the variables!");
+
+        return m_Slots[slot];
+    }
+
+    // Note: Every node only refers to nodes before it, so one pass from
+    //       front to back, keeping one value per node, is all it takes.
+    const double* Run(const PostfixExpression& expr)
+    {
+        if(expr.Empty())
+            throw EvaluatorException("Incorrect abstract syntax tree");
+
+        size_t count = expr.Nodes.size();
+        if(m_Values.size() < count)
+            m_Values.resize(count);
+
+        const PostfixNode* nodes = &expr.Nodes[0];
+        double* values = &m_Values[0];
+
+        for(size_t i = 0; i < count; i++) {
+            const PostfixNode& node = nodes[i];
+
+            if(node.Op == NumberValue) {
+                values[i] = expr.Constants[node.Left];
+                continue;
+            }
+            else if(node.Op == Variable) {
+                values[i] = Lookup(node.Left);
+                continue;
+            }
+
+            if(node.Left >= i || (node.Op != UnaryMinus && node.Right >= i))
+                throw EvaluatorException("Incorrect syntax tree!");
+
+            double v1 = values[node.Left];
+            switch(node.Op) {
+            case UnaryMinus:    values[i] = -v1; break;
+            case OperatorPlus:  values[i] = v1 + values[node.Right]; break;
+            case OperatorMinus: values[i] = v1 - values[node.Right]; break;
+            case OperatorMul:   values[i] = v1 * values[node.Right]; break;
+            case OperatorDiv:   values[i] = v1 / values[node.Right]; break;
+            default:
+                throw EvaluatorException("Incorrect syntax tree!");
+            }
+        }
+
+        return values;
+    }
+
+    double EvaluateSubtree(ASTNode* ast, size_t depth)
+    {
+        if(ast == NULL) 
+            throw EvaluatorException("Incorrect syntax tree!");
+
+        if(depth > m_RecursionLimit)
+            return EvaluateWithStack(ast);
+
+        if(ast->Type == NumberValue)
+            return ast->Value;
+        else if(ast->Type == Variable)
+            return Lookup(ast->Slot);
+        else if(ast->Type == UnaryMinus)
+            return -EvaluateSubtree(ast->Left, depth + 1);
+        else 
+        {
+            double v1 = EvaluateSubtree(ast->Left, depth + 1);
+            double v2 = EvaluateSubtree(ast->Right, depth + 1);
+            switch(ast->Type) {
+            case OperatorPlus:  return v1 + v2;
+            case OperatorMinus: return v1 - v2;
+            case OperatorMul:   return v1 * v2;
+            case OperatorDiv:   return v1 / v2;
+            default:
+                throw EvaluatorException("Incorrect syntax tree!");
+            }
+        }
+    }
+
+    // Leaves go straight to the values; only inner nodes need a frame.
+    void Visit(ASTNode* ast)
+    {
+        if(ast != NULL && ast->Type == NumberValue)
+            m_Values.push_back(ast->Value);
+        else if(ast != NULL && ast->Type == Variable)
+            m_Values.push_back(Lookup(ast->Slot));
+        else {
+            Frame frame = { ast, 0 };
+            m_Frames.push_back(frame);
+        }
+    }
+
+    // Note: The same post-order walk as EvaluateSubtree, with the frames
+    //       and the intermediate values on vectors: a binary node is visited
+    //       three times (State 0, 1, 2), pushing its left child, then its
+    //       right child, and then combining the two values on top of
+    //       m_Values. Errors are detected in the same order, too.
+    //
+    //       It never calls back into EvaluateSubtree, so the Auto mode can
+    //       share the vectors.
+    double EvaluateWithStack(ASTNode* ast)
+    {
+        m_Frames.clear();
+        m_Values.clear();
+        Visit(ast);
+
+        while(!m_Frames.empty()) {
+            Frame& frame = m_Frames.back();
+            ASTNode* node = frame.Node;
+
+            if(node == NULL)
+                throw EvaluatorException("Incorrect syntax tree!");
+
+            if(node->Type == UnaryMinus) {
+                if(frame.State++ == 0)
+                    Visit(node->Left);
+                else {
+                    m_Values.back() = -m_Values.back();
+                    m_Frames.pop_back();
+                }
+            }
+            else {
+                int state = frame.State++;
+                if(state == 0)
+                    Visit(node->Left);
+                else if(state == 1)
+                    Visit(node->Right);
+                else {
+                    double v2 = m_Values.back();
+                    m_Values.pop_back();
+                    double& v1 = m_Values.back();
+
+                    switch(node->Type) {
+                    case OperatorPlus:  v1 = v1 + v2; break;
+                    case OperatorMinus: v1 = v1 - v2; break;
+                    case OperatorMul:   v1 = v1 * v2; break;
+                    case OperatorDiv:   v1 = v1 / v2; break;
+                    default:
+                        throw EvaluatorException("Incorrect syntax tree!");
+                    }
+                    m_Frames.pop_back();
+                }
+            }
+        }
+
+        return m_Values.back();
+    }
+
+public:
+    Evaluator(Mode mode = Auto):m_Slots(NULL)
+    {
+        SetMode(mode);
+    }
+
+    void SetMode(Mode mode)
+    {
+        m_Mode = mode;
+        m_RecursionLimit = mode == Auto ? (size_t)MaxRecursion : (size_t)-1;
+    }
+
+    // 'slots' holds the value of each variable, indexed by the slot the
+    // SymbolTable gave it while parsing.
+    double Evaluate(ASTNode* ast, const double* slots = NULL)
+    {
+        if(ast == NULL)
+            throw EvaluatorException("Incorrect abstract syntax tree");
+
+        m_Slots = slots;
+        if(m_Mode == ExplicitStack)
+            return EvaluateWithStack(ast);
+
+        return EvaluateSubtree(ast, 0);
+    }
+
+    double Evaluate(const PostfixExpression& expr, const double* slots = NULL)
+    {
+        m_Slots = slots;
+
+        return Run(expr)[expr.Root()];
+    }
+
+    // Evaluates several expressions that share one set of nodes, as in an
+    // ExpressionSet: results[k] is the value of node outputs[k]. Each node
+    // is computed once, whichever outputs need it.
+    void Evaluate(const PostfixExpression& expr, const uint32_t* outputs, size_t count,
+                  const double* slots, double* results)
+    {
+        m_Slots = slots;
+        const double* values = Run(expr);
+
+        for(size_t k = 0; k < count; k++) {
+            if(outputs[k] >= expr.Nodes.size())
+                throw EvaluatorException("Incorrect syntax tree!");
+            results[k] = values[outputs[k]];
+        }
+    }
+};
@@ -0,0 +1,261 @@
+/*
+ * ExpressionCache.h - A thread-safe LRU cache of parsed expressions.
+ *
+ * Note: When the same few formulas come in over and over again, there is no
+ *       point in tokenizing and parsing them every time. The cache maps the
+ *       text of an expression to its parsed, immutable postfix form, which
+ *       any number of threads can then evaluate at the same time, each with
+ *       its own Evaluator:
+ *
+ *        ExpressionCache cache(16 << 20);           // 16 MB
+ *
+ *        ExpressionCache::Entry expr = cache.Get("x*x + 2*y");
+ *        double slots[] = { 3, 4 };                 // see expr->Symbols
+ *        double value = evaluator.Evaluate(expr->Code, slots);
+ *
+ *       The entries are spread over a number of shards by the hash of
+ *       their text; each shard has its own lock, its own least recently
+ *       used list and an equal part of the memory limit. A miss parses
+ *       outside of the lock, so a slow parse does not hold up the other
+ *       threads. Texts that do not parse are not cached; Get() throws the
+ *       ParserException. The text has to be the expression and nothing
+ *       else, as for ParseStrict(): 'x+1)' is an error, not 'x+1'.
+ *
+ *       The text is hashed once per Get(), and a hit looks it up in place,
+ *       so it copies and allocates nothing; the index points into the Text
+ *       of the entries themselves.
+ */
+
+#ifndef EXPRESSIONCACHE_H
+#  define EXPRESSIONCACHE_H 1
+#endif
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef POSTFIX_H
+#  include "Postfix.h"
+#endif
+
+// The parsed form of one text. 'Symbols' gives the slot of each variable.
+struct CachedExpression {
+    std::string       Text;
+    PostfixExpression Code;
+    SymbolTable       Symbols;
+
+    // A rough count of the memory held, bookkeeping included; the index
+    // of the cache keeps no copy of the text.
+    size_t Bytes() const
+    {
+        size_t bytes = sizeof(CachedExpression) + 128 + Text.capacity()
+                     + Code.Nodes.capacity() * sizeof(PostfixNode)
+                     + Code.Constants.capacity() * sizeof(double);
+
+        for(size_t i = 0; i < Symbols.Size(); i++)
+            bytes += 96 + Symbols.Name((unsigned)i).capacity();
+
+        return bytes;
+    }
+};
+
+class ExpressionCache
+{
+public:
+    typedef std::shared_ptr<const CachedExpression> Entry;
+
+    struct Statistics {
+        uint64_t Hits;
+        uint64_t Misses;
+        uint64_t Evictions;
+        size_t   Entries;
+        size_t   Bytes;
+    };
+
+private:
+    typedef std::list<Entry> LruList;
+
+    // A text that is not copied: the one looked up, or an entry's own.
+    struct Key {
+        const char* Text;
+        size_t      Length;
+        size_t      Hash;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const
+        {
+            return key.Hash;
+        }
+    };
+
+    struct KeyEqual {
+        bool operator()(const Key& a, const Key& b) const
+        {
+            return a.Length == b.Length && memcmp(a.Text, b.Text, a.Length) == 0;
+        }
+    };
+
+    typedef std::unordered_map<Key, LruList::iterator, KeyHash, KeyEqual> IndexMap;
+
+    struct Shard {
+        std::mutex      Lock;
+        LruList         Lru;        // most recent first
+        IndexMap        Index;      // keys point into the entries' Text
+        size_t          Bytes;
+        uint64_t        Hits;
+        uint64_t        Misses;
+        uint64_t        Evictions;
+
+        Shard():Bytes(0), Hits(0), Misses(0), Evictions(0)
+        {}
+    };
+
+    std::vector<Shard*> m_Shards;
+    size_t              m_ShardLimit;
+
+    // FNV-1a.
+    static Key MakeKey(const char* text, size_t length)
+    {
+        uint64_t h = 0xCBF29CE484222325ULL;
+        for(size_t i = 0; i < length; i++)
+            h = (h ^ (unsigned char)text[i]) * 0x100000001B3ULL;
+
+        Key key = { text, length, (size_t)(h ^ (h >> 32)) };
+        return key;
+    }
+
+    Shard& ShardFor(const Key& key)
+    {
+        return *m_Shards[key.Hash % m_Shards.size()];
+    }
+
+    // Drop least recently used entries until 'bytes' more fit. Called with
+    // the shard locked.
+    void MakeRoom(Shard& shard, size_t bytes)
+    {
+        while(!shard.Lru.empty() && shard.Bytes + bytes > m_ShardLimit) {
+            const Entry& victim = shard.Lru.back();
+            shard.Bytes -= victim->Bytes();
+            shard.Index.erase(MakeKey(victim->Text.data(), victim->Text.size()));
+            shard.Lru.pop_back();
+            shard.Evictions++;
+        }
+    }
+
+    // Not copyable: the shards own their locks.
+    ExpressionCache(const ExpressionCache&);
+    ExpressionCache& operator=(const ExpressionCache&);
+
+public:
+    ExpressionCache(size_t maxBytes = 64 << 20, size_t shards = 16)
+    {
+        if(shards == 0)
+            shards = 1;
+
+        for(size_t i = 0; i < shards; i++)
+            m_Shards.push_back(new Shard);
+
+        m_ShardLimit = maxBytes / shards;
+    }
+
+    ~ExpressionCache()
+    {
+        for(size_t i = 0; i < m_Shards.size(); i++)
+            delete m_Shards[i];
+    }
+
+    Entry Get(const char* text, size_t length)
+    {
+        Key key = MakeKey(text, length);
+        Shard& shard = ShardFor(key);
+
+        {
+            std::lock_guard<std::mutex> lock(shard.Lock);
+
+            IndexMap::iterator it = shard.Index.find(key);
+            if(it != shard.Index.end()) {
+                shard.Lru.splice(shard.Lru.begin(), shard.Lru, it->second);
+                shard.Hits++;
+                return *it->second;
+            }
+
+            shard.Misses++;
+        }
+
+        std::shared_ptr<CachedExpression> parsed(new CachedExpression);
+        parsed->Text.assign(text, length);
+
+        ErrorInfo error;
+        PostfixParser(&parsed->Code, &parsed->Symbols).ParseStrict(parsed->Text.c_str(), length, error);
+        if(error.Code != ErrorInfo::None)
+            throw ParserException(error.Message(), (int)error.Position);
+
+        Entry entry = parsed;
+        size_t bytes = entry->Bytes();
+
+        std::lock_guard<std::mutex> lock(shard.Lock);
+
+        // Another thread may have parsed the same text in the meantime.
+        IndexMap::iterator it = shard.Index.find(key);
+        if(it != shard.Index.end())
+            return *it->second;
+
+        if(bytes > m_ShardLimit)
+            return entry;
+
+        MakeRoom(shard, bytes);
+        shard.Lru.push_front(entry);
+        key.Text = entry->Text.data();
+        shard.Index[key] = shard.Lru.begin();
+        shard.Bytes += bytes;
+
+        return entry;
+    }
+
+    Entry Get(const char* text)
+    {
+        return Get(text, strlen(text));
+    }
+
+    Entry Get(const std::string& text)
+    {
+        return Get(text.data(), text.size());
+    }
+
+    Statistics GetStatistics()
+    {
+        Statistics stats = { 0, 0, 0, 0, 0 };
+
+        for(size_t i = 0; i < m_Shards.size(); i++) {
+            Shard& shard = *m_Shards[i];
+            std::lock_guard<std::mutex> lock(shard.Lock);
+
+            stats.Hits += shard.Hits;
+            stats.Misses += shard.Misses;
+            stats.Evictions += shard.Evictions;
+            stats.Entries += shard.Index.size();
+            stats.Bytes += shard.Bytes;
+        }
+
+        return stats;
+    }
+
+    // Entries still in use elsewhere stay valid; they are only forgotten.
+    void Clear()
+    {
+        for(size_t i = 0; i < m_Shards.size(); i++) {
+            Shard& shard = *m_Shards[i];
+            std::lock_guard<std::mutex> lock(shard.Lock);
+
+            shard.Lru.clear();
+            shard.Index.clear();
+            shard.Bytes = 0;
+        }
+    }
+};
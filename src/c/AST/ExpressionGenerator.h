@@ -0,0 +1,184 @@
+/*
+ * ExpressionGenerator.h - Random, reproducible expressions for benchmarks.
+ *
+ * Note: The expressions follow the grammar of the parsers (EXP/TERM/FACTOR
+ *       with numbers only), so every one of them parses, with the C++
+ *       Parser as well as with '../ast/evalexp.c'. Each is built as a random
+ *       binary tree with a given number of numbers, e.g. with 'Terms' 4,
+ *
+ *        (12.5 - -3) * 7/ 41
+ *
+ *       The same seed and Options always give the same expressions, on any
+ *       platform: the generator has its own random numbers (splitmix64)
+ *       and does not use the <random> distributions, which differ between
+ *       standard libraries.
+ */
+
+#ifndef EXPRESSIONGENERATOR_H
+#  define EXPRESSIONGENERATOR_H 1
+#endif
+
+#include <string>
+#include <stdint.h>
+
+class ExpressionGenerator
+{
+public:
+    struct Options {
+        unsigned Terms;         // numbers per expression
+        unsigned MaxDepth;      // most parentheses and unary minuses around a number
+
+        // Relative weights of the binary operators.
+        unsigned Plus;
+        unsigned Minus;
+        unsigned Mul;
+        unsigned Div;
+
+        // Percentages.
+        unsigned Negate;        // numbers with a unary minus
+        unsigned Parenthesize;  // subexpressions in parentheses
+        unsigned Spaces;        // tokens followed by a blank
+
+        // Relative weights of the number formats: "407", "31.25", and 16 to
+        // 31 digits with a point somewhere.
+        unsigned Integers;
+        unsigned Decimals;
+        unsigned Long;
+
+        Options():
+            Terms(8), MaxDepth(4),
+            Plus(4), Minus(4), Mul(3), Div(2),
+            Negate(10), Parenthesize(30), Spaces(20),
+            Integers(6), Decimals(3), Long(1)
+        {
+        }
+    };
+
+private:
+    uint64_t m_State;
+    Options  m_Options;
+
+    uint64_t Random()
+    {
+        uint64_t z = (m_State += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // 0 .. n-1
+    unsigned Below(unsigned n)
+    {
+        return n == 0 ? 0 : (unsigned)(Random() % n);
+    }
+
+    bool Percent(unsigned percent)
+    {
+        return Below(100) < percent;
+    }
+
+    void Space(std::string& text)
+    {
+        if(Percent(m_Options.Spaces))
+            text += ' ';
+    }
+
+    void Digits(std::string& text, unsigned count)
+    {
+        for(unsigned i = 0; i < count; i++)
+            text += (char)('0' + Below(10));
+    }
+
+    void Literal(std::string& text)
+    {
+        unsigned total = m_Options.Integers + m_Options.Decimals + m_Options.Long;
+        unsigned pick = Below(total ? total : 1);
+
+        if(pick < m_Options.Integers || total == 0)
+            Digits(text, 1 + Below(5));
+        else if(pick < m_Options.Integers + m_Options.Decimals) {
+            Digits(text, 1 + Below(4));
+            text += '.';
+            Digits(text, 1 + Below(4));
+        }
+        else {
+            // Note: ConstExpr.h takes at most 31 characters per number.
+            unsigned digits = 16 + Below(15);
+            unsigned point = 1 + Below(digits - 1);
+            Digits(text, point);
+            text += '.';
+            Digits(text, digits - point);
+        }
+
+        Space(text);
+    }
+
+    char Operator()
+    {
+        const Options& o = m_Options;
+        unsigned pick = Below(o.Plus + o.Minus + o.Mul + o.Div);
+
+        if(pick < o.Plus)
+            return '+';
+        if(pick < o.Plus + o.Minus)
+            return '-';
+        if(pick < o.Plus + o.Minus + o.Mul)
+            return '*';
+        return o.Plus + o.Minus + o.Mul + o.Div ? '/' : '+';
+    }
+
+    void Expression(std::string& text, unsigned terms, unsigned depth)
+    {
+        if(terms <= 1) {
+            if(depth < m_Options.MaxDepth && Percent(m_Options.Negate)) {
+                text += '-';
+                Space(text);
+                depth++;
+            }
+            Literal(text);
+            return;
+        }
+
+        bool parenthesize = depth < m_Options.MaxDepth && Percent(m_Options.Parenthesize);
+        if(parenthesize) {
+            text += '(';
+            Space(text);
+            depth++;
+        }
+
+        unsigned left = 1 + Below(terms - 1);
+        Expression(text, left, depth);
+        text += Operator();
+        Space(text);
+        Expression(text, terms - left, depth);
+
+        if(parenthesize) {
+            text += ')';
+            Space(text);
+        }
+    }
+
+public:
+    ExpressionGenerator(uint64_t seed, const Options& options = Options()):
+        m_State(seed), m_Options(options)
+    {
+    }
+
+    const Options& GetOptions() const
+    {
+        return m_Options;
+    }
+
+    // Appends one expression to 'text'.
+    void Generate(std::string& text)
+    {
+        Expression(text, m_Options.Terms ? m_Options.Terms : 1, 0);
+    }
+
+    std::string Generate()
+    {
+        std::string text;
+        Generate(text);
+        return text;
+    }
+};
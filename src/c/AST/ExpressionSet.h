@@ -0,0 +1,171 @@
+/*
+ * ExpressionSet.h - Compiles many formulas into one program that evaluates
+ * them all in a single pass.
+ *
+ * Note: Related formulas tend to have parts in common. All formulas added to
+ *       a set go into one shared DAG (see Dag.h), so a subexpression that
+ *       occurs in several of them -- or several times in one -- is a single
+ *       node, computed once per row for all of them. Each formula gets an
+ *       output slot, the index returned by Add():
+ *
+ *        SymbolTable symbols;
+ *        ExpressionSet set(&symbols);
+ *        set.Add("(x-y)*(x-y)");                 // output 0
+ *        set.Add("(x-y)/(x+y)");                 // output 1, shares x-y
+ *
+ *        double slots[] = { 3, 1 };              // in slot order
+ *        double results[2];
+ *        set.Evaluate(slots, results);           // 4, 0.5
+ *
+ *       or, over columns of rows with the BatchEvaluator, one output column
+ *       per formula:
+ *
+ *        const double* columns[] = { xs, ys };
+ *        double* outputs[] = { squares, ratios };
+ *        set.Evaluate(columns, rows, outputs);
+ *
+ *       Since sharing is exact, every result is bit for bit the one the
+ *       formula gives on its own. A formula that does not parse, in full,
+ *       throws the ParserException and leaves the set as it was, including
+ *       the symbol table: names it declared before the error are forgotten.
+ */
+
+#ifndef EXPRESSIONSET_H
+#  define EXPRESSIONSET_H 1
+#endif
+
+#include <vector>
+
+#ifndef DAG_H
+#  include "Dag.h"
+#endif
+
+#ifndef EVALUATOR_H
+#  include "Evaluator.h"
+#endif
+
+#ifndef BATCHEVALUATOR_H
+#  include "BatchEvaluator.h"
+#endif
+
+class ExpressionSet
+{
+    // The parser begins every formula; the set keeps what came before.
+    class SetBuilder : public DagBuilder
+    {
+    public:
+        SetBuilder(PostfixExpression* expr = NULL):
+            DagBuilder(expr)
+        {
+        }
+
+        void Begin()
+        {
+        }
+    };
+
+    PostfixExpression          m_Expr;
+    std::vector<uint32_t>      m_Outputs;   // the root node of each formula
+    BasicParser<SetBuilder>    m_Parser;
+    Evaluator                  m_Evaluator;
+    BatchEvaluator             m_Batch;
+
+    // Not copyable: the parser's builder points at m_Expr.
+    ExpressionSet(const ExpressionSet&);
+    ExpressionSet& operator=(const ExpressionSet&);
+
+public:
+    ExpressionSet(SymbolTable* symbols = NULL):
+        m_Parser(SetBuilder(&m_Expr), symbols)
+    {
+    }
+
+    // E.g. for SetMaxDepth(), which applies as in Parse().
+    BasicParser<SetBuilder>& GetParser()
+    {
+        return m_Parser;
+    }
+
+    // Returns the output slot of the formula.
+    size_t Add(const char* text)
+    {
+        return Add(text, (size_t)-1);
+    }
+
+    size_t Add(const char* text, size_t length)
+    {
+        SetBuilder& builder = m_Parser.GetBuilder();
+        DagBuilder::Mark mark = builder.GetMark();
+        SymbolTable* symbols = m_Parser.GetSymbols();
+        size_t declared = symbols != NULL ? symbols->Size() : 0;
+
+        ErrorInfo error;
+        uint32_t root = m_Parser.ParseStrict(text, length, error);
+        if(error.Code != ErrorInfo::None) {
+            builder.Rollback(mark);
+            if(symbols != NULL)
+                symbols->Truncate(declared);
+            throw ParserException(error.Message(), (int)error.Position);
+        }
+
+        m_Outputs.push_back(root);
+        return m_Outputs.size() - 1;
+    }
+
+    size_t Add(ASTNode* ast)
+    {
+        SetBuilder& builder = m_Parser.GetBuilder();
+        DagBuilder::Mark mark = builder.GetMark();
+
+        uint32_t root;
+        if(!Flatten(ast, builder, &root)) {
+            builder.Rollback(mark);
+            throw EvaluatorException("Incorrect abstract syntax tree");
+        }
+
+        m_Outputs.push_back(root);
+        return m_Outputs.size() - 1;
+    }
+
+    void Clear()
+    {
+        m_Parser.GetBuilder().DagBuilder::Begin();
+        m_Outputs.clear();
+    }
+
+    size_t Size() const
+    {
+        return m_Outputs.size();
+    }
+
+    // The shared nodes, and the node of each output in them.
+    const PostfixExpression& GetExpression() const
+    {
+        return m_Expr;
+    }
+
+    const std::vector<uint32_t>& GetOutputs() const
+    {
+        return m_Outputs;
+    }
+
+    // TreeNodes counts the nodes of all formulas, each on its own.
+    DagBuilder::Statistics GetStatistics()
+    {
+        return m_Parser.GetBuilder().GetStatistics();
+    }
+
+    // Fills in results[k] for each output k.
+    void Evaluate(const double* slots, double* results)
+    {
+        if(!m_Outputs.empty())
+            m_Evaluator.Evaluate(m_Expr, &m_Outputs[0], m_Outputs.size(), slots, results);
+    }
+
+    // Fills in the 'rows' values of the column results[k] for each output k.
+    void Evaluate(const double* const* columns, size_t rows, double* const* results)
+    {
+        if(!m_Outputs.empty())
+            m_Batch.Evaluate(m_Expr, &m_Outputs[0], m_Outputs.size(), columns, rows, results);
+    }
+};
@@ -0,0 +1,322 @@
+/*
+ * Jit.h - Compiles an AST to native x86-64 code.
+ *
+ * Note: Even the VM decodes and dispatches every instruction on every run.
+ *       For the hottest formulas the bytecode of Bytecode.h is translated,
+ *       once, into straight-line SSE2 code in executable memory, with the
+ *       stack of the VM mapped onto the xmm registers:
+ *
+ *       For example, '1+2*3' becomes,
+ *
+ *        movsd  xmm0, [rdi+0]      ; PUSH 0
+ *        movsd  xmm1, [rdi+8]      ; PUSH 1
+ *        movsd  xmm2, [rdi+16]     ; PUSH 2
+ *        mulsd  xmm1, xmm2         ; MUL
+ *        addsd  xmm0, xmm1         ; ADD
+ *        ret                       ; the result is in xmm0
+ *
+ *       The generated function follows the System V calling convention,
+ *
+ *        double f(const double* constants,     // rdi
+ *                 const double* slots,         // rsi
+ *                 double* spill);              // rdx
+ *
+ *       Stack entries 0..14 live in xmm0..xmm14; deeper ones are spilled to
+ *       'spill', and xmm15 is the scratch register. Unary minus flips the
+ *       sign bit, like the compiler does for '-x', and every other operation
+ *       is the same scalar IEEE operation the Evaluator does, so the results
+ *       agree bit for bit.
+ *
+ *       Where there is no JIT (another CPU or OS, EVALEXP_NO_JIT defined, or
+ *       no executable memory to be had), the program simply runs on the VM:
+ *
+ *        JitExpression expr;
+ *        expr.Compile(ast);
+ *        double value = expr.Evaluate(slots);      // native or not
+ */
+
+#ifndef JIT_H
+#  define JIT_H 1
+#endif
+
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef BYTECODE_H
+#  include "Bytecode.h"
+#endif
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__)) \
+    && !defined(EVALEXP_NO_JIT)
+#  define EVALEXP_JIT 1
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
+// Assembles the few SSE2 instructions the JIT needs.
+class JitAssembler
+{
+public:
+    enum Register {
+        RDX = 2,
+        RSI = 6,
+        RDI = 7
+    };
+
+    enum {
+        MOVSD_LOAD  = 0x10,
+        MOVSD_STORE = 0x11,
+        XORPD       = 0x57,
+        ADDSD       = 0x58,
+        MULSD       = 0x59,
+        SUBSD       = 0x5C,
+        DIVSD       = 0x5E
+    };
+
+    std::vector<uint8_t> Code;
+
+    // op xmm, [base + disp]; movsd stores the other way around.
+    void Memory(uint8_t opcode, unsigned xmm, Register base, int32_t disp)
+    {
+        Code.push_back(0xF2);
+        if(xmm >= 8)
+            Code.push_back(0x44);                               // REX.R
+        Code.push_back(0x0F);
+        Code.push_back(opcode);
+        ModRM(xmm & 7, base, disp);
+    }
+
+    // op dst, src
+    void Registers(uint8_t opcode, unsigned dst, unsigned src)
+    {
+        Code.push_back(opcode == XORPD ? 0x66 : 0xF2);
+        if(dst >= 8 || src >= 8)
+            Code.push_back(0x40 | (dst >= 8 ? 4 : 0) | (src >= 8 ? 1 : 0));
+        Code.push_back(0x0F);
+        Code.push_back(opcode);
+        Code.push_back(0xC0 | (dst & 7) << 3 | (src & 7));
+    }
+
+    // btc qword [base + disp], 63: flips the sign of a spilled value.
+    void FlipSign(Register base, int32_t disp)
+    {
+        Code.push_back(0x48);                                   // REX.W
+        Code.push_back(0x0F);
+        Code.push_back(0xBA);
+        ModRM(7, base, disp);
+        Code.push_back(63);
+    }
+
+    void Return()
+    {
+        Code.push_back(0xC3);
+    }
+
+private:
+    void ModRM(unsigned reg, Register base, int32_t disp)
+    {
+        if(disp >= -128 && disp <= 127) {
+            Code.push_back(0x40 | reg << 3 | base);
+            Code.push_back((uint8_t)disp);
+        }
+        else {
+            Code.push_back(0x80 | reg << 3 | base);
+            for(int i = 0; i < 4; i++)
+                Code.push_back((uint8_t)((uint32_t)disp >> (8 * i)));
+        }
+    }
+};
+
+class JitExpression
+{
+public:
+    enum { StackRegisters = 15 };
+
+private:
+    typedef double (*Function)(const double* constants, const double* slots, double* spill);
+
+    Program             m_Program;
+    VirtualMachine      m_VM;
+    std::vector<double> m_Constants;    // the program's, plus the sign mask
+    std::vector<double> m_Spill;
+    void*               m_Code;
+    size_t              m_CodeSize;
+    Function            m_Function;
+
+    // Not copyable: owns the executable memory.
+    JitExpression(const JitExpression&);
+    JitExpression& operator=(const JitExpression&);
+
+    void Release()
+    {
+#ifdef EVALEXP_JIT
+        if(m_Code != NULL)
+            munmap(m_Code, m_CodeSize);
+#endif
+        m_Code = NULL;
+        m_CodeSize = 0;
+        m_Function = NULL;
+    }
+
+    // Displacements are 32 bits wide.
+    static bool Addressable(size_t index)
+    {
+        return index < ((size_t)1 << 28);
+    }
+
+    static int32_t Spilled(size_t position)
+    {
+        return (int32_t)(8 * (position - StackRegisters));
+    }
+
+    // Returns false if the program cannot be translated.
+    bool Assemble(JitAssembler& as)
+    {
+        m_Constants = m_Program.Constants;
+        size_t mask = m_Constants.size();
+        m_Constants.push_back(-0.0);
+
+        if(!Addressable(mask) || !Addressable(m_Program.MaxStack))
+            return false;
+
+        const uint32_t* ip = &m_Program.Code[0];
+        size_t depth = 0;
+
+        for(;;) {
+            uint32_t op = *ip++;
+
+            switch(op) {
+            case OpPush:
+            case OpLoad: {
+                uint32_t index = *ip++;
+                if(!Addressable(index))
+                    return false;
+
+                JitAssembler::Register base = op == OpPush ? JitAssembler::RDI : JitAssembler::RSI;
+                if(depth < StackRegisters)
+                    as.Memory(JitAssembler::MOVSD_LOAD, (unsigned)depth, base, 8 * index);
+                else {
+                    as.Memory(JitAssembler::MOVSD_LOAD, 15, base, 8 * index);
+                    as.Memory(JitAssembler::MOVSD_STORE, 15, JitAssembler::RDX, Spilled(depth));
+                }
+                depth++;
+                break;
+            }
+
+            case OpAdd:
+            case OpSub:
+            case OpMul:
+            case OpDiv: {
+                static const uint8_t opcodes[] = {
+                    JitAssembler::ADDSD, JitAssembler::SUBSD,
+                    JitAssembler::MULSD, JitAssembler::DIVSD
+                };
+                uint8_t opcode = opcodes[op - OpAdd];
+                size_t a = depth - 2, b = depth - 1;
+
+                if(b < StackRegisters)
+                    as.Registers(opcode, (unsigned)a, (unsigned)b);
+                else if(a < StackRegisters)
+                    as.Memory(opcode, (unsigned)a, JitAssembler::RDX, Spilled(b));
+                else {
+                    as.Memory(JitAssembler::MOVSD_LOAD, 15, JitAssembler::RDX, Spilled(a));
+                    as.Memory(opcode, 15, JitAssembler::RDX, Spilled(b));
+                    as.Memory(JitAssembler::MOVSD_STORE, 15, JitAssembler::RDX, Spilled(a));
+                }
+                depth--;
+                break;
+            }
+
+            case OpNeg:
+                if(depth - 1 < StackRegisters) {
+                    as.Memory(JitAssembler::MOVSD_LOAD, 15, JitAssembler::RDI, (int32_t)(8 * mask));
+                    as.Registers(JitAssembler::XORPD, (unsigned)(depth - 1), 15);
+                }
+                else
+                    as.FlipSign(JitAssembler::RDX, Spilled(depth - 1));
+                break;
+
+            case OpReturn:
+                as.Return();
+                return true;
+
+            default:
+                return false;
+            }
+        }
+    }
+
+    void Translate()
+    {
+#ifdef EVALEXP_JIT
+        JitAssembler as;
+        if(!Assemble(as))
+            return;
+
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t size = (as.Code.size() + page - 1) / page * page;
+
+        void* code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(code == MAP_FAILED)
+            return;
+
+        // Note: Writable or executable, never both at once.
+        memcpy(code, &as.Code[0], as.Code.size());
+        if(mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(code, size);
+            return;
+        }
+
+        m_Code = code;
+        m_CodeSize = size;
+        m_Function = (Function)code;
+
+        if(m_Program.MaxStack > StackRegisters)
+            m_Spill.resize(m_Program.MaxStack - StackRegisters);
+#endif
+    }
+
+public:
+    JitExpression():
+        m_Code(NULL), m_CodeSize(0), m_Function(NULL)
+    {
+    }
+
+    ~JitExpression()
+    {
+        Release();
+    }
+
+    // Throws EvaluatorException for a malformed tree, like Compiler does.
+    void Compile(ASTNode* ast)
+    {
+        Release();
+        Compiler().Compile(ast, m_Program);
+        Translate();
+    }
+
+    void Compile(const Program& program)
+    {
+        Release();
+        m_Program = program;
+        Translate();
+    }
+
+    // False if Evaluate() runs on the VM.
+    bool IsNative() const
+    {
+        return m_Function != NULL;
+    }
+
+    double Evaluate(const double* slots = NULL)
+    {
+        if(m_Function == NULL)
+            return m_VM.Run(m_Program, slots);
+
+        if(m_Program.UsesSlots && slots == NULL)
+            throw EvaluatorException("No values given for the variables!");
+
+        return m_Function(&m_Constants[0], slots, m_Spill.empty() ? NULL : &m_Spill[0]);
+    }
+};
@@ -0,0 +1,445 @@
+/*
+ * Lexer.h - Splits a whole expression into tokens before it is parsed.
+ *
+ * Note: Instead of looking at one character at a time, the lexer first
+ *       classifies a block of 64 characters at once into bit masks, one
+ *       bit per character,
+ *
+ *        text    "(12.5 + x1)*3   "
+ *        Space    0000010100000111
+ *        Digit    0110100001001000
+ *        Word     0110100011001000     (letters, '_' and digits)
+ *        Punct    1000001000110000     ('+', '-', '*', '/', '(' and ')')
+ *
+ *       (bit i is the i-th character, drawn left to right) with AVX2 or
+ *       SSE4.2 where the CPU has them, chosen at run time, or 8 at a time
+ *       in a 64-bit integer otherwise. Whitespace is then skipped, and the
+ *       digits of a number or the characters of a name are found, by
+ *       counting trailing zeros in the masks; only the characters that
+ *       start a token are looked at one by one.
+ *
+ *       The result is an array of 16-byte tokens, ending with EndOfText,
+ *       which BasicParser then reads instead of the text. A character that
+ *       starts no token ends the array with an Error token at its position;
+ *       the parser raises the error only if it gets that far, so the
+ *       errors, and their positions, are the same as before, and anything
+ *       after the end of the expression is still ignored.
+ *
+ *       Names are ASCII letters, digits and '_' (isalpha() in the "C"
+ *       locale) and are only tokens if 'identifiers' is set. Texts must be
+ *       shorter than 4 GB (see MaxLength). Define EVALEXP_NO_SIMD to use the integer
+ *       classifier everywhere.
+ */
+
+#ifndef LEXER_H
+#  define LEXER_H 1
+#endif
+
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef AST_H
+#  include "AST.h"
+#endif
+
+#ifndef FASTFLOAT_H
+#  include "../ast/fastfloat.h"
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__)) \
+    && !defined(EVALEXP_NO_SIMD)
+#  define EVALEXP_SIMD_X86 1
+#  include <immintrin.h>
+#endif
+
+struct LexToken {
+    union {
+        double   Value;         // of a Number
+        uint32_t Start;         // of an Identifier's name
+    };
+    uint32_t End;               // the position after the token, or of an Error
+    uint8_t  Type;              // TokenType
+    char     Symbol;            // the character of an operator, parenthesis or Error
+};
+
+class Lexer
+{
+public:
+    enum Level {
+        Scalar,
+        Sse42,
+        Avx2,
+        Best                    // the best one the CPU has
+    };
+
+    struct Masks {
+        uint64_t Space;
+        uint64_t Digit;
+        uint64_t Word;
+        uint64_t Punct;
+    };
+
+    enum { BlockSize = 64 };
+
+    // Positions are 32-bit, and the end of the text needs one, too.
+    enum { MaxLength = 0xFFFFFFFEu };
+
+    typedef void (*Classifier)(const char* block, Masks& masks);
+
+private:
+    std::vector<LexToken> m_Tokens;
+    const char*           m_Text;
+    size_t                m_Length;
+    size_t                m_Block;      // the block in m_Masks
+    Masks                 m_Masks;
+    Classifier            m_Classify;
+    bool                  m_Values;
+
+    // Note: Without SIMD, the characters are classified 8 at a time in a
+    //       64-bit integer, one byte each: Between() sets the high bit of
+    //       the bytes in a range, Equal() of those equal to 'c' (exactly,
+    //       nothing carries from one byte into the next), and Compress()
+    //       gathers the high bits into 8 adjacent bits.
+    static uint64_t Between(uint64_t x, unsigned above, unsigned below)
+    {
+        const uint64_t ones = 0x0101010101010101ull, lows = 0x7F7F7F7F7F7F7F7Full;
+        return (ones * (127 + below) - (x & lows)) & ~x & ((x & lows) + ones * (127 - above))
+               & 0x8080808080808080ull;
+    }
+
+    static uint64_t Equal(uint64_t x, unsigned c)
+    {
+        const uint64_t lows = 0x7F7F7F7F7F7F7F7Full;
+        uint64_t t = x ^ (0x0101010101010101ull * c);
+        return ~(((t & lows) + lows) | t) & 0x8080808080808080ull;
+    }
+
+    static uint64_t Compress(uint64_t highs)
+    {
+        return (highs * 0x02040810204081ull) >> 56;
+    }
+
+    static void ClassifyScalar(const char* block, Masks& masks)
+    {
+        uint64_t spaces = 0, digits = 0, words = 0, puncts = 0;
+
+        for(int i = 0; i < BlockSize; i += 8) {
+            uint64_t x = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            memcpy(&x, block + i, sizeof(x));
+#else
+            for(int k = 7; k >= 0; k--)
+                x = x << 8 | (unsigned char)block[i + k];
+#endif
+
+            uint64_t space = Equal(x, ' ') | Between(x, '\t' - 1, '\r' + 1);
+            uint64_t digit = Between(x, '0' - 1, '9' + 1);
+            uint64_t word  = digit | Between(x, 'A' - 1, 'Z' + 1) | Between(x, 'a' - 1, 'z' + 1)
+                             | Equal(x, '_');
+            uint64_t punct = Between(x, '(' - 1, '/' + 1) & ~Equal(x, ',') & ~Equal(x, '.');
+
+            spaces |= Compress(space) << i;
+            digits |= Compress(digit) << i;
+            words  |= Compress(word) << i;
+            puncts |= Compress(punct) << i;
+        }
+
+        masks.Space = spaces;
+        masks.Digit = digits;
+        masks.Word = words;
+        masks.Punct = puncts;
+    }
+
+#ifdef EVALEXP_SIMD_X86
+    // Note: The operators and parentheses are the characters 0x28-0x2F
+    //       but ',' and '.': here a table lookup by the low nibble (pshufb)
+    //       and a compare of the high one. The ranges are compared as
+    //       unsigned bytes, 'c - low <= span'.
+    //
+    //       SSE4.2 does have instructions made for this, pcmpestrm with a
+    //       set of ranges, but they took more than twice as long here as
+    //       these compares, so the 16-byte path only needs SSSE3 in fact.
+    __attribute__((target("sse4.2")))
+    static __m128i InRange(__m128i v, char low, char span)
+    {
+        __m128i offset = _mm_sub_epi8(v, _mm_set1_epi8(low));
+        return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(span)), offset);
+    }
+
+    __attribute__((target("sse4.2")))
+    static void ClassifySse42(const char* block, Masks& masks)
+    {
+        const __m128i low = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, -1, -1, -1, -1, 0, -1, 0, -1);
+
+        Masks m = { 0, 0, 0, 0 };
+        for(int i = 0; i < BlockSize; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(block + i));
+
+            __m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), InRange(v, '\t', 4));
+            __m128i digit = InRange(v, '0', 9);
+            __m128i alpha = _mm_or_si128(InRange(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 25),
+                                         _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+            __m128i high  = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+            __m128i punct = _mm_and_si128(_mm_cmpeq_epi8(high, _mm_set1_epi8(2)), _mm_shuffle_epi8(low, v));
+
+            m.Space |= (uint64_t)(uint16_t)_mm_movemask_epi8(space) << i;
+            m.Digit |= (uint64_t)(uint16_t)_mm_movemask_epi8(digit) << i;
+            m.Word  |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(alpha, digit)) << i;
+            m.Punct |= (uint64_t)(uint16_t)_mm_movemask_epi8(punct) << i;
+        }
+
+        masks = m;
+    }
+
+    // The same, 32 characters at a time.
+    __attribute__((target("avx2")))
+    static __m256i InRange(__m256i v, char low, char span)
+    {
+        __m256i offset = _mm256_sub_epi8(v, _mm256_set1_epi8(low));
+        return _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(span)), offset);
+    }
+
+    __attribute__((target("avx2")))
+    static void ClassifyAvx2(const char* block, Masks& masks)
+    {
+        const __m256i low = _mm256_setr_epi8(
+            0, 0, 0, 0, 0, 0, 0, 0, -1, -1, -1, -1, 0, -1, 0, -1,
+            0, 0, 0, 0, 0, 0, 0, 0, -1, -1, -1, -1, 0, -1, 0, -1);
+
+        Masks m = { 0, 0, 0, 0 };
+        for(int i = 0; i < BlockSize; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(block + i));
+
+            __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), InRange(v, '\t', 4));
+            __m256i digit = InRange(v, '0', 9);
+            __m256i alpha = _mm256_or_si256(InRange(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 25),
+                                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+            __m256i high  = _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+            __m256i punct = _mm256_and_si256(_mm256_cmpeq_epi8(high, _mm256_set1_epi8(2)),
+                                             _mm256_shuffle_epi8(low, v));
+
+            m.Space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(space) << i;
+            m.Digit |= (uint64_t)(uint32_t)_mm256_movemask_epi8(digit) << i;
+            m.Word  |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(alpha, digit)) << i;
+            m.Punct |= (uint64_t)(uint32_t)_mm256_movemask_epi8(punct) << i;
+        }
+
+        masks = m;
+    }
+#endif
+
+    static Level Supported()
+    {
+#ifdef EVALEXP_SIMD_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2"))
+            return Avx2;
+        if(__builtin_cpu_supports("sse4.2"))
+            return Sse42;
+#endif
+        return Scalar;
+    }
+
+    static int TrailingZeros(uint64_t x)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(x);
+#else
+        int n = 0;
+        for(; !(x & 1); x >>= 1)
+            n++;
+        return n;
+#endif
+    }
+
+    const Masks& MasksAt(size_t position)
+    {
+        size_t block = position / BlockSize;
+
+        if(block != m_Block) {
+            const char* begin = m_Text + block * BlockSize;
+            m_Block = block;
+
+            if(block * BlockSize + BlockSize <= m_Length)
+                m_Classify(begin, m_Masks);
+            else {
+                // The last block, padded with NULs, which are in no class.
+                char tail[BlockSize] = { 0 };
+                memcpy(tail, begin, m_Length - block * BlockSize);
+                m_Classify(tail, m_Masks);
+            }
+        }
+
+        return m_Masks;
+    }
+
+    // The first position from 'position' on whose character is not in the
+    // class 'set'.
+    size_t Skip(uint64_t Masks::* set, size_t position)
+    {
+        while(position < m_Length) {
+            uint64_t rest = ~(MasksAt(position).*set) >> (position % BlockSize);
+            if(rest != 0)
+                return position + TrailingZeros(rest);
+
+            position = (position / BlockSize + 1) * BlockSize;
+        }
+
+        return m_Length;
+    }
+
+    void Add(TokenType type, char symbol, size_t end, double value = 0)
+    {
+        LexToken token;
+        token.Value = value;
+        token.End = (uint32_t)end;
+        token.Type = (uint8_t)type;
+        token.Symbol = symbol;
+
+        m_Tokens.push_back(token);
+    }
+
+    static TokenType Operator(char c)
+    {
+        switch(c) {
+        case '+': return Plus;
+        case '-': return Minus;
+        case '*': return Mul;
+        case '/': return Div;
+        case '(': return OpenParenthesis;
+        default:  return ClosedParenthesis;
+        }
+    }
+
+    // Note: The digits are found with the masks; only a number with an
+    //       exponent is scanned again, character by character.
+    size_t AddNumber(size_t position)
+    {
+        number_parts parts;
+        size_t end = Skip(&Masks::Digit, position);
+
+        parts.integer = m_Text + position;
+        parts.integer_len = end - position;
+        parts.fraction = m_Text + end;
+        parts.fraction_len = 0;
+        parts.exponent = 0;
+
+        if(end < m_Length && m_Text[end] == '.') {
+            size_t fraction = end + 1;
+            end = Skip(&Masks::Digit, fraction);
+            parts.fraction = m_Text + fraction;
+            parts.fraction_len = end - fraction;
+        }
+
+        double value = 0;
+        if(end < m_Length && (m_Text[end] == 'e' || m_Text[end] == 'E'))
+            end = position + evalexp_scan_number(m_Text + position, m_Length - position, &value);
+        else if(m_Values)
+            value = number_convert(&parts);
+
+        Add(Number, 0, end, value);
+        return end;
+    }
+
+public:
+    Lexer(Level level = Best):
+        m_Text(NULL), m_Length(0), m_Block(0), m_Classify(ClassifyScalar), m_Values(true)
+    {
+        SetLevel(level);
+    }
+
+    // Without values, numbers are only found, not converted (those with
+    // an exponent excepted); their tokens all have the value 0.
+    void SetValues(bool values)
+    {
+        m_Values = values;
+    }
+
+    // Falls back to the best level below 'level' that the CPU has.
+    void SetLevel(Level level)
+    {
+        static const Level best = Supported();
+        if(level > best)
+            level = best;
+
+        m_Classify = ClassifyScalar;
+#ifdef EVALEXP_SIMD_X86
+        if(level == Avx2)
+            m_Classify = ClassifyAvx2;
+        else if(level == Sse42)
+            m_Classify = ClassifySse42;
+#endif
+    }
+
+    Level GetLevel() const
+    {
+#ifdef EVALEXP_SIMD_X86
+        if(m_Classify == ClassifyAvx2)
+            return Avx2;
+        if(m_Classify == ClassifySse42)
+            return Sse42;
+#endif
+        return Scalar;
+    }
+
+    static const char* LevelName(Level level)
+    {
+        static const char* names[] = { "scalar", "sse4.2", "avx2", "best" };
+        return names[level];
+    }
+
+    // The tokens of the 'length' characters at 'text' (up to a NUL, if
+    // there is one, as in BasicParser::Parse()). Returns the length of the
+    // text that was looked at. A text longer than MaxLength is not scanned
+    // at all: there are no tokens, and the caller has to check the length.
+    size_t Scan(const char* text, size_t length, bool identifiers)
+    {
+        const char* nul = (const char*)(length == (size_t)-1 ? text + strlen(text) : memchr(text, 0, length));
+        if(nul != NULL)
+            length = nul - text;
+
+        m_Text = text;
+        m_Length = length;
+        m_Block = (size_t)-1;
+        m_Tokens.clear();
+        if(length > MaxLength)
+            return length;
+
+        for(size_t position = 0;;) {
+            position = Skip(&Masks::Space, position);
+            if(position >= m_Length) {
+                Add(EndOfText, 0, m_Length);
+                break;
+            }
+
+            const Masks& masks = MasksAt(position);
+            uint64_t bit = (uint64_t)1 << (position % BlockSize);
+            char c = m_Text[position];
+
+            if(masks.Punct & bit) {
+                Add(Operator(c), c, ++position);
+            }
+            else if(masks.Digit & bit) {
+                position = AddNumber(position);
+            }
+            else if(identifiers && (masks.Word & bit)) {
+                size_t end = Skip(&Masks::Word, position);
+                Add(Identifier, c, end);
+                m_Tokens.back().Start = (uint32_t)position;
+                position = end;
+            }
+            else {
+                Add(Error, c, position);
+                break;
+            }
+        }
+
+        return m_Length;
+    }
+
+    const std::vector<LexToken>& Tokens() const
+    {
+        return m_Tokens;
+    }
+};
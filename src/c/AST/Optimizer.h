@@ -0,0 +1,658 @@
+/*
+ * Optimizer.h - Folds constants and simplifies an AST before it is
+ * evaluated.
+ *
+ * Note: The optimizer rewrites the tree in place, bottom up, and returns
+ *       its new root; it never allocates a node, since every rule can reuse
+ *       the nodes it rewrites. The nodes it drops are deleted, unless the
+ *       tree lives in an arena:
+ *
+ *        ASTNode* ast = parser.Parse("x*(2*3) + 0*y");
+ *        ast = Optimizer().Optimize(ast);             // x*6 + 0*y
+ *        ast = Optimizer(Optimizer::FastMath).Optimize(ast);   // x*6
+ *
+ *       Strict rules give the same result as the original tree for every
+ *       input, bit for bit (quiet NaNs included):
+ *
+ *        ------------------------------------------------------------------
+ *       |RULE                     |WHY IT IS EXACT                         |
+ *        ------------------------------------------------------------------
+ *       |c1 op c2   -> c          |the same IEEE operation, done now       |
+ *       |-c         -> (-c)       |                                        |
+ *       |--x        -> x          |negation only flips the sign bit        |
+ *       |x*1, 1*x   -> x          |                                        |
+ *       |x/1        -> x          |                                        |
+ *       |x-0        -> x          |+0 only: -0-0 is -0, but -0-(-0) is +0  |
+ *       |x+(-0)     -> x          |-0 only: -0+0 is +0                     |
+ *       |x/2^k      -> x*2^-k     |2^-k is exact, so both round x/2^k alike|
+ *        ------------------------------------------------------------------
+ *
+ *       The one exception is not the Optimizer's: of two NaN operands, the
+ *       CPU passes on the first, but the compiler may swap the operands of
+ *       + and *, so which of the two the Evaluator returns may differ from
+ *       one tree, or one build, to the next.
+ *
+ *       FastMath adds rules that hold for real numbers but not always for
+ *       doubles -- rounding, signed zeros, infinities and NaNs may differ:
+ *
+ *        ------------------------------------------------------------------
+ *       |x+0, 0+x, x-0 -> x        |x*0, 0*x    -> 0                       |
+ *       |0-x          -> -x        |x*-1, x/-1  -> -x                      |
+ *       |x-(-y)       -> x+y       |x+(-y)      -> x-y,  (-x)+y -> y-x     |
+ *       |(-x)*(-y)    -> x*y       |(-x)/(-y)   -> x/y                     |
+ *       |c+x          -> x+c       |c*x         -> x*c                     |
+ *       |x-c          -> x+(-c)    |x/c         -> x*(1/c)                 |
+ *       |(x+c1)+c2    -> x+(c1+c2) |(x*c1)*c2   -> x*(c1*c2)               |
+ *       |(x+c)+y      -> (x+y)+c   |y+(x+c)     -> (y+x)+c                 |
+ *       |(x+c)-y      -> (x-y)+c   |y-(x+c)     -> (y-x)+(-c)              |
+ *       |(x*c)*y      -> (x*y)*c   |y*(x*c)     -> (y*x)*c                 |
+ *       |(x*c)/y      -> (x/y)*c   |y/(x*c)     -> (y/x)*(1/c)             |
+ *        ------------------------------------------------------------------
+ *
+ *       so the constants of a sum or a product move to its top and end up
+ *       as one, e.g. '2*x*3 + 1 + y - 4' is '(x*6 + y) + -3'.
+ *
+ *       With SetRebalance(true), FastMath also rebuilds every chain of three
+ *       or more operands of one + or * as a balanced tree. The parser makes
+ *       'a+b+c+d' a chain, '((a+b)+c)+d', in which every addition waits for
+ *       the one before; '(a+b)+(c+d)' has the same operands in the same
+ *       order, but its depth grows with log2 of their number, so the CPU can
+ *       overlap the operations and separate subtrees can be evaluated
+ *       separately. The split goes by the number of operands, so an
+ *       operand much deeper than the others can end up a level or two
+ *       deeper than in the chain. The nodes are reused; GetStatistics() has
+ *       the depth of the tree before and after.
+ *
+ *       The tree is walked with an explicit stack, so any depth works.
+ */
+
+#ifndef OPTIMIZER_H
+#  define OPTIMIZER_H 1
+#endif
+
+#include <vector>
+#include <math.h>
+
+#ifndef AST_H
+#  include "AST.h"
+#endif
+
+#ifndef ARENA_H
+#  include "Arena.h"
+#endif
+
+class Optimizer
+{
+public:
+    enum Mode {
+        Strict,
+        FastMath
+    };
+
+    struct Statistics {
+        size_t NodesBefore;
+        size_t NodesAfter;
+        size_t Folded;          // operations done by the optimizer
+        size_t Rewritten;       // other rules applied
+        size_t DepthBefore;     // the longest path from the root, in nodes
+        size_t DepthAfter;
+        size_t Rebalanced;      // chains rebuilt as balanced trees
+
+        Statistics():
+            NodesBefore(0), NodesAfter(0), Folded(0), Rewritten(0),
+            DepthBefore(0), DepthAfter(0), Rebalanced(0)
+        {
+        }
+    };
+
+private:
+    struct Frame {
+        ASTNode** Slot;         // where the parent points at the node
+        bool      Visited;      // its children are done
+        size_t    Depth;
+    };
+
+    Mode m_Mode;
+    NodeArena* m_Arena;
+    bool m_Rebalance;
+    Statistics m_Stats;
+    std::vector<Frame> m_Frames;
+    std::vector<ASTNode*> m_Nodes;
+    std::vector<ASTNode*> m_Operands;   // of the chain being rebalanced
+    std::vector<ASTNode*> m_Inner;      // its + or * nodes
+    std::vector<ASTNode**> m_Pending;   // subtrees still to rebalance
+
+    static bool IsNumber(const ASTNode* node)
+    {
+        return node->Type == NumberValue;
+    }
+
+    static bool IsNumber(const ASTNode* node, double value)
+    {
+        return node->Type == NumberValue && node->Value == value;
+    }
+
+    // A zero with the given sign.
+    static bool IsZero(const ASTNode* node, bool negative)
+    {
+        return IsNumber(node, 0) && (signbit(node->Value) != 0) == negative;
+    }
+
+    static bool IsBinary(const ASTNode* node, ASTNodeType type)
+    {
+        return node->Type == type && node->Left != NULL && node->Right != NULL;
+    }
+
+    // A sum or product with a constant right operand, '(x+c)' or '(x*c)'.
+    static bool HasConstant(const ASTNode* node, ASTNodeType type)
+    {
+        return IsBinary(node, type) && IsNumber(node->Right) && !IsNumber(node->Left);
+    }
+
+    static bool ExactReciprocal(double value)
+    {
+        int exponent;
+        double reciprocal = 1 / value;
+
+        return fabs(frexp(value, &exponent)) == 0.5 && reciprocal != 0 && isfinite(reciprocal);
+    }
+
+    static double Apply(ASTNodeType type, double v1, double v2)
+    {
+        switch(type) {
+        case OperatorPlus:  return v1 + v2;
+        case OperatorMinus: return v1 - v2;
+        case OperatorMul:   return v1 * v2;
+        default:            return v1 / v2;
+        }
+    }
+
+    // Note: A node is unlinked from its children before it is deleted;
+    //       a whole subtree goes at once.
+    void Drop(ASTNode* node)
+    {
+        node->Left = node->Right = NULL;
+        if(m_Arena == NULL)
+            delete node;
+    }
+
+    void DropTree(ASTNode* node)
+    {
+        if(m_Arena == NULL)
+            delete node;
+    }
+
+    void MakeNumber(ASTNode* node, double value)
+    {
+        if(node->Left != NULL)
+            DropTree(node->Left);
+        if(node->Right != NULL)
+            DropTree(node->Right);
+
+        node->Type = NumberValue;
+        node->Value = value;
+        node->Left = node->Right = NULL;
+    }
+
+    // *slot becomes its child 'keep'; the node and its other child go.
+    void Keep(ASTNode** slot, ASTNode* keep)
+    {
+        ASTNode* node = *slot;
+        ASTNode* other = node->Left == keep ? node->Right : node->Left;
+
+        *slot = keep;
+        Drop(node);
+        if(other != NULL)
+            DropTree(other);
+    }
+
+    // The node becomes '-operand'; 'dropped', its other child, goes.
+    void MakeUnary(ASTNode* node, ASTNode* operand, ASTNode* dropped)
+    {
+        node->Type = UnaryMinus;
+        node->Left = operand;
+        node->Right = NULL;
+        Drop(dropped);
+    }
+
+    // '-x' in place of 'minus', which was '-x'.
+    static ASTNode* Unwrap(ASTNode* minus)
+    {
+        ASTNode* operand = minus->Left;
+        minus->Left = NULL;
+        return operand;
+    }
+
+    // Note: 'node' is 'a op (b op2 c)' or '(a op2 c) op b', with 'inner' the
+    //       parenthesized node, and becomes '(a inner b) op c': 'inner' is
+    //       reused for 'a inner b' and simplified again.
+    void Lift(ASTNode* node, ASTNode* inner, ASTNodeType innerType, ASTNode* a, ASTNode* b,
+              ASTNodeType type, ASTNode* c)
+    {
+        inner->Type = innerType;
+        inner->Left = a;
+        inner->Right = b;
+        node->Type = type;
+        node->Left = inner;
+        node->Right = c;
+
+        Simplify(&node->Left);
+    }
+
+    bool RewriteStrict(ASTNode** slot)
+    {
+        ASTNode* node = *slot;
+        ASTNode* left = node->Left;
+        ASTNode* right = node->Right;
+
+        switch(node->Type) {
+        case OperatorPlus:
+            if(IsZero(right, true)) {
+                Keep(slot, left);
+                return true;
+            }
+            if(IsZero(left, true)) {
+                Keep(slot, right);
+                return true;
+            }
+            break;
+
+        case OperatorMinus:
+            if(IsZero(right, false)) {
+                Keep(slot, left);
+                return true;
+            }
+            break;
+
+        case OperatorMul:
+            if(IsNumber(right, 1)) {
+                Keep(slot, left);
+                return true;
+            }
+            if(IsNumber(left, 1)) {
+                Keep(slot, right);
+                return true;
+            }
+            break;
+
+        case OperatorDiv:
+            if(IsNumber(right, 1)) {
+                Keep(slot, left);
+                return true;
+            }
+            if(IsNumber(right) && ExactReciprocal(right->Value)) {
+                node->Type = OperatorMul;
+                right->Value = 1 / right->Value;
+                return true;
+            }
+            break;
+
+        default:
+            break;
+        }
+
+        return false;
+    }
+
+    bool RewriteFast(ASTNode** slot)
+    {
+        ASTNode* node = *slot;
+        ASTNode* left = node->Left;
+        ASTNode* right = node->Right;
+
+        switch(node->Type) {
+        case OperatorPlus:
+            if(IsNumber(right, 0)) {
+                Keep(slot, left);
+                return true;
+            }
+            if(IsNumber(left)) {
+                node->Left = right;
+                node->Right = left;
+                return true;
+            }
+            if(right->Type == UnaryMinus && right->Left != NULL) {
+                node->Type = OperatorMinus;
+                node->Right = Unwrap(right);
+                Drop(right);
+                return true;
+            }
+            if(left->Type == UnaryMinus && left->Left != NULL) {
+                node->Type = OperatorMinus;
+                node->Left = right;
+                node->Right = Unwrap(left);
+                Drop(left);
+                return true;
+            }
+            if(HasConstant(left, OperatorPlus)) {
+                if(IsNumber(right)) {
+                    left->Right->Value += right->Value;
+                    Keep(slot, left);
+                }
+                else
+                    Lift(node, left, OperatorPlus, left->Left, right, OperatorPlus, left->Right);
+                return true;
+            }
+            if(HasConstant(right, OperatorPlus)) {
+                Lift(node, right, OperatorPlus, left, right->Left, OperatorPlus, right->Right);
+                return true;
+            }
+            break;
+
+        case OperatorMinus:
+            if(IsNumber(right)) {
+                node->Type = OperatorPlus;
+                right->Value = -right->Value;
+                return true;
+            }
+            if(IsNumber(left, 0)) {
+                MakeUnary(node, right, left);
+                return true;
+            }
+            if(right->Type == UnaryMinus && right->Left != NULL) {
+                node->Type = OperatorPlus;
+                node->Right = Unwrap(right);
+                Drop(right);
+                return true;
+            }
+            if(HasConstant(left, OperatorPlus)) {
+                Lift(node, left, OperatorMinus, left->Left, right, OperatorPlus, left->Right);
+                return true;
+            }
+            if(HasConstant(right, OperatorPlus)) {
+                ASTNode* c = right->Right;
+                c->Value = -c->Value;
+                Lift(node, right, OperatorMinus, left, right->Left, OperatorPlus, c);
+                return true;
+            }
+            break;
+
+        case OperatorMul:
+            if(IsNumber(right, 0) || IsNumber(left, 0)) {
+                MakeNumber(node, 0);
+                return true;
+            }
+            if(IsNumber(left)) {
+                node->Left = right;
+                node->Right = left;
+                return true;
+            }
+            if(IsNumber(right, -1)) {
+                MakeUnary(node, left, right);
+                return true;
+            }
+            if(left->Type == UnaryMinus && right->Type == UnaryMinus
+               && left->Left != NULL && right->Left != NULL) {
+                node->Left = Unwrap(left);
+                node->Right = Unwrap(right);
+                Drop(left);
+                Drop(right);
+                return true;
+            }
+            if(HasConstant(left, OperatorMul)) {
+                if(IsNumber(right)) {
+                    left->Right->Value *= right->Value;
+                    Keep(slot, left);
+                }
+                else
+                    Lift(node, left, OperatorMul, left->Left, right, OperatorMul, left->Right);
+                return true;
+            }
+            if(HasConstant(right, OperatorMul)) {
+                Lift(node, right, OperatorMul, left, right->Left, OperatorMul, right->Right);
+                return true;
+            }
+            break;
+
+        case OperatorDiv:
+            if(IsNumber(right) && right->Value != 0 && isfinite(right->Value)) {
+                node->Type = OperatorMul;
+                right->Value = 1 / right->Value;
+                return true;
+            }
+            if(left->Type == UnaryMinus && right->Type == UnaryMinus
+               && left->Left != NULL && right->Left != NULL) {
+                node->Left = Unwrap(left);
+                node->Right = Unwrap(right);
+                Drop(left);
+                Drop(right);
+                return true;
+            }
+            if(HasConstant(left, OperatorMul)) {
+                Lift(node, left, OperatorDiv, left->Left, right, OperatorMul, left->Right);
+                return true;
+            }
+            if(HasConstant(right, OperatorMul)) {
+                ASTNode* c = right->Right;
+                c->Value = 1 / c->Value;
+                Lift(node, right, OperatorDiv, left, right->Left, OperatorMul, c);
+                return true;
+            }
+            break;
+
+        default:
+            break;
+        }
+
+        return false;
+    }
+
+    // Applies one rule to *slot, whose children are done; false if none
+    // applies.
+    bool Rewrite(ASTNode** slot)
+    {
+        ASTNode* node = *slot;
+
+        if(node->Type == UnaryMinus) {
+            ASTNode* operand = node->Left;
+            if(operand == NULL)
+                return false;
+
+            if(IsNumber(operand)) {
+                MakeNumber(node, -operand->Value);
+                m_Stats.Folded++;
+                return true;
+            }
+            if(operand->Type == UnaryMinus && operand->Left != NULL) {
+                *slot = Unwrap(operand);
+                Drop(operand);
+                Drop(node);
+                m_Stats.Rewritten++;
+                return true;
+            }
+            return false;
+        }
+
+        if(node->Type < OperatorPlus || node->Type > OperatorDiv
+           || node->Left == NULL || node->Right == NULL)
+            return false;
+
+        if(IsNumber(node->Left) && IsNumber(node->Right)) {
+            MakeNumber(node, Apply(node->Type, node->Left->Value, node->Right->Value));
+            m_Stats.Folded++;
+            return true;
+        }
+
+        if(RewriteStrict(slot) || (m_Mode == FastMath && RewriteFast(slot))) {
+            m_Stats.Rewritten++;
+            return true;
+        }
+
+        return false;
+    }
+
+    void Simplify(ASTNode** slot)
+    {
+        while(Rewrite(slot))
+            ;
+    }
+
+    // Counts the nodes of the tree, and gives its depth in 'depth'.
+    size_t CountNodes(ASTNode** root, size_t& depth)
+    {
+        size_t count = 0;
+        depth = 0;
+
+        m_Frames.clear();
+        Frame top = { root, false, 1 };
+        m_Frames.push_back(top);
+        while(!m_Frames.empty()) {
+            Frame frame = m_Frames.back();
+            m_Frames.pop_back();
+            ASTNode* node = *frame.Slot;
+            count++;
+            if(frame.Depth > depth)
+                depth = frame.Depth;
+
+            if(node->Left != NULL) {
+                Frame left = { &node->Left, false, frame.Depth + 1 };
+                m_Frames.push_back(left);
+            }
+            if(node->Right != NULL) {
+                Frame right = { &node->Right, false, frame.Depth + 1 };
+                m_Frames.push_back(right);
+            }
+        }
+
+        return count;
+    }
+
+    void Pending(ASTNode** slot)
+    {
+        if((*slot)->Left != NULL)
+            m_Pending.push_back(slot);
+    }
+
+    // Collects the operands of the chain of 'type' at 'node' in m_Operands,
+    // left to right, and its nodes in m_Inner.
+    void Gather(ASTNode* node, ASTNodeType type)
+    {
+        m_Operands.clear();
+        m_Inner.clear();
+
+        m_Nodes.clear();
+        m_Nodes.push_back(node);
+        while(!m_Nodes.empty()) {
+            node = m_Nodes.back();
+            m_Nodes.pop_back();
+
+            if(IsBinary(node, type)) {
+                m_Inner.push_back(node);
+                m_Nodes.push_back(node->Right);
+                m_Nodes.push_back(node->Left);
+            }
+            else
+                m_Operands.push_back(node);
+        }
+    }
+
+    // Note: Joins the operands [first, last) with the next unused nodes of
+    //       m_Inner; the recursion is only as deep as the result.
+    ASTNode* Build(size_t first, size_t last, size_t& next)
+    {
+        if(last - first == 1)
+            return m_Operands[first];
+
+        size_t middle = first + (last - first) / 2;
+        ASTNode* node = m_Inner[next++];
+
+        node->Left = Build(first, middle, next);
+        if(middle - first == 1)
+            Pending(&node->Left);
+        node->Right = Build(middle, last, next);
+        if(last - middle == 1)
+            Pending(&node->Right);
+
+        return node;
+    }
+
+    void Rebalance(ASTNode** root)
+    {
+        m_Pending.clear();
+        Pending(root);
+
+        while(!m_Pending.empty()) {
+            ASTNode** slot = m_Pending.back();
+            m_Pending.pop_back();
+            ASTNode* node = *slot;
+
+            if(IsBinary(node, OperatorPlus) || IsBinary(node, OperatorMul)) {
+                Gather(node, node->Type);
+                if(m_Operands.size() > 2) {
+                    size_t next = 0;
+                    *slot = Build(0, m_Operands.size(), next);
+                    m_Stats.Rebalanced++;
+                    continue;
+                }
+            }
+
+            if(node->Left != NULL)
+                Pending(&node->Left);
+            if(node->Right != NULL)
+                Pending(&node->Right);
+        }
+    }
+
+public:
+    // Without an arena, the tree is taken to come from 'new', and the nodes
+    // it loses are deleted.
+    Optimizer(Mode mode = Strict, NodeArena* arena = NULL):
+        m_Mode(mode), m_Arena(arena), m_Rebalance(false)
+    {
+    }
+
+    // Reassociates, so it only applies in FastMath.
+    void SetRebalance(bool rebalance)
+    {
+        m_Rebalance = rebalance;
+    }
+
+    ASTNode* Optimize(ASTNode* ast)
+    {
+        m_Stats = Statistics();
+        if(ast == NULL)
+            return NULL;
+
+        m_Frames.clear();
+        Frame root = { &ast, false, 1 };
+        m_Frames.push_back(root);
+
+        while(!m_Frames.empty()) {
+            size_t top = m_Frames.size() - 1;
+            ASTNode* node = *m_Frames[top].Slot;
+
+            if(m_Frames[top].Visited) {
+                Simplify(m_Frames[top].Slot);
+                m_Frames.pop_back();
+                continue;
+            }
+
+            m_Frames[top].Visited = true;
+            m_Stats.NodesBefore++;
+
+            size_t depth = m_Frames[top].Depth;
+            if(depth > m_Stats.DepthBefore)
+                m_Stats.DepthBefore = depth;
+
+            if(node->Right != NULL) {
+                Frame right = { &node->Right, false, depth + 1 };
+                m_Frames.push_back(right);
+            }
+            if(node->Left != NULL) {
+                Frame left = { &node->Left, false, depth + 1 };
+                m_Frames.push_back(left);
+            }
+        }
+
+        if(m_Mode == FastMath && m_Rebalance)
+            Rebalance(&ast);
+
+        m_Stats.NodesAfter = CountNodes(&ast, m_Stats.DepthAfter);
+        return ast;
+    }
+
+    const Statistics& GetStatistics() const
+    {
+        return m_Stats;
+    }
+};
@@ -0,0 +1,342 @@
+/*
+ * ParallelEvaluator.h - Evaluates one huge tree on several cores.
+ *
+ * Note: The two operands of an operator do not depend on each other, so a
+ *       big enough right subtree is forked off as a task while the thread
+ *       goes on with the left one, and the two values are combined when
+ *       both are there. Each thread keeps its tasks in its own deque: it
+ *       pushes and pops at the back, and an idle thread steals from the
+ *       front of another's, where the oldest and so the biggest tasks are.
+ *       A thread waiting for a stolen task runs other tasks meanwhile.
+ *
+ *        ParallelEvaluator parallel(4);            // the caller and 3 more
+ *        double value = parallel.Evaluate(ast, slots);
+ *
+ *       Which subtrees are worth a task is decided by ASTNode::Size, which
+ *       the parser counts as it builds the tree; subtrees of fewer than
+ *       'grain' nodes are evaluated by the thread's own Evaluator. After
+ *       the Optimizer, or for a tree built by hand, Annotate() counts the
+ *       sizes again. Stale sizes only make the split less even.
+ *
+ *       Every operation is the Evaluator's, on the same operands in the
+ *       same order, so the result is the same bit for bit, with one
+ *       exception: of two NaN operands, the compiler may pass on either,
+ *       as it may swap the operands of + and *, and it need not do so the
+ *       same way here and in the Evaluator (e.g. -O1 with ThreadSanitizer
+ *       does not). So a NaN result may differ in its sign. A malformed
+ *       tree or missing slots throw the EvaluatorException.
+ *
+ *       Only a chain, as the parser makes of 'a+b+c+...', has no two big
+ *       operands to run side by side; the Optimizer's FastMath rebalancing
+ *       makes it a tree that has.
+ */
+
+#ifndef PARALLELEVALUATOR_H
+#  define PARALLELEVALUATOR_H 1
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef EVALUATOR_H
+#  include "Evaluator.h"
+#endif
+
+class ParallelEvaluator
+{
+public:
+    enum { DefaultGrain = 1 << 14 };
+
+    // Deeper than this, forking stops and the thread's Evaluator takes the
+    // whole subtree, so the native stack stays bounded.
+    enum { MaxForkDepth = 1024 };
+
+private:
+    struct Task {
+        ASTNode*           Node;
+        double             Result;
+        std::exception_ptr Error;
+        std::atomic<bool>  Done;
+    };
+
+    struct Worker {
+        std::mutex         Lock;
+        std::deque<Task*>  Tasks;
+        Evaluator          Eval;
+        std::thread        Thread;
+    };
+
+    std::vector<Worker*>    m_Workers;      // [0] is the calling thread
+    size_t                  m_Grain;
+    const double*           m_Slots;
+
+    std::mutex              m_Lock;
+    std::condition_variable m_Wake;
+    bool                    m_Running;      // an Evaluate() is under way
+    bool                    m_Stop;
+    std::atomic<bool>       m_Busy;         // m_Running, for the spinning
+
+    // Not copyable: owns the threads.
+    ParallelEvaluator(const ParallelEvaluator&);
+    ParallelEvaluator& operator=(const ParallelEvaluator&);
+
+    void Push(size_t self, Task* task)
+    {
+        std::lock_guard<std::mutex> lock(m_Workers[self]->Lock);
+        m_Workers[self]->Tasks.push_back(task);
+    }
+
+    // Takes 'task' back if no other thread has stolen it.
+    bool Reclaim(size_t self, Task* task)
+    {
+        std::lock_guard<std::mutex> lock(m_Workers[self]->Lock);
+        std::deque<Task*>& tasks = m_Workers[self]->Tasks;
+
+        if(tasks.empty() || tasks.back() != task)
+            return false;
+
+        tasks.pop_back();
+        return true;
+    }
+
+    // The newest of our own tasks, or else the oldest of someone else's.
+    Task* Take(size_t self)
+    {
+        for(size_t k = 0; k < m_Workers.size(); k++) {
+            Worker* worker = m_Workers[(self + k) % m_Workers.size()];
+            std::lock_guard<std::mutex> lock(worker->Lock);
+
+            if(worker->Tasks.empty())
+                continue;
+
+            Task* task;
+            if(k == 0) {
+                task = worker->Tasks.back();
+                worker->Tasks.pop_back();
+            }
+            else {
+                task = worker->Tasks.front();
+                worker->Tasks.pop_front();
+            }
+            return task;
+        }
+
+        return NULL;
+    }
+
+    bool RunOne(size_t self, size_t depth)
+    {
+        Task* task = Take(self);
+        if(task == NULL)
+            return false;
+
+        try {
+            task->Result = Run(self, task->Node, depth + 1);
+        }
+        catch(...) {
+            task->Error = std::current_exception();
+        }
+        task->Done.store(true, std::memory_order_release);
+
+        return true;
+    }
+
+    void Wait(size_t self, Task* task, size_t depth)
+    {
+        while(!task->Done.load(std::memory_order_acquire))
+            if(!RunOne(self, depth))
+                std::this_thread::yield();
+    }
+
+    double Join(size_t self, Task* task, size_t depth)
+    {
+        if(Reclaim(self, task))
+            return Run(self, task->Node, depth + 1);
+
+        Wait(self, task, depth);
+        if(task->Error)
+            std::rethrow_exception(task->Error);
+
+        return task->Result;
+    }
+
+    double Run(size_t self, ASTNode* node, size_t depth)
+    {
+        if(node == NULL)
+            throw EvaluatorException("Incorrect syntax tree!");
+
+        if(ASTNode::SubtreeSize(node) < m_Grain || depth >= MaxForkDepth
+           || node->Type == NumberValue || node->Type == Variable)
+            return m_Workers[self]->Eval.Evaluate(node, m_Slots);
+
+        if(node->Type == UnaryMinus)
+            return -Run(self, node->Left, depth + 1);
+
+        double v1, v2;
+        if(node->Right != NULL && ASTNode::SubtreeSize(node->Right) >= m_Grain) {
+            Task task;
+            task.Node = node->Right;
+            task.Result = 0;
+            task.Done.store(false, std::memory_order_relaxed);
+            Push(self, &task);
+
+            // Note: The task lives in this frame, so it has to be off the
+            //       deque or done before an exception may leave it.
+            try {
+                v1 = Run(self, node->Left, depth + 1);
+            }
+            catch(...) {
+                if(!Reclaim(self, &task))
+                    Wait(self, &task, depth);
+                throw;
+            }
+            v2 = Join(self, &task, depth);
+        }
+        else {
+            v1 = Run(self, node->Left, depth + 1);
+            v2 = Run(self, node->Right, depth + 1);
+        }
+
+        switch(node->Type) {
+        case OperatorPlus:  return v1 + v2;
+        case OperatorMinus: return v1 - v2;
+        case OperatorMul:   return v1 * v2;
+        case OperatorDiv:   return v1 / v2;
+        default:
+            throw EvaluatorException("Incorrect syntax tree!");
+        }
+    }
+
+    void Work(size_t self)
+    {
+        for(;;) {
+            {
+                std::unique_lock<std::mutex> lock(m_Lock);
+                while(!m_Running && !m_Stop)
+                    m_Wake.wait(lock);
+                if(m_Stop)
+                    return;
+            }
+
+            while(m_Busy.load(std::memory_order_acquire))
+                if(!RunOne(self, 0))
+                    std::this_thread::yield();
+        }
+    }
+
+    void Finish()
+    {
+        m_Busy.store(false, std::memory_order_release);
+
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Running = false;
+    }
+
+public:
+    // 'threads' counts the calling thread, which takes part in every
+    // evaluation; 0 means one per core.
+    ParallelEvaluator(unsigned threads = 0, size_t grain = DefaultGrain):
+        m_Grain(grain < 2 ? 2 : grain), m_Slots(NULL), m_Running(false), m_Stop(false)
+    {
+        m_Busy.store(false);
+
+        if(threads == 0)
+            threads = std::thread::hardware_concurrency();
+        if(threads == 0)
+            threads = 1;
+
+        for(unsigned i = 0; i < threads; i++)
+            m_Workers.push_back(new Worker);
+        for(unsigned i = 1; i < threads; i++)
+            m_Workers[i]->Thread = std::thread(&ParallelEvaluator::Work, this, (size_t)i);
+    }
+
+    ~ParallelEvaluator()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            m_Stop = true;
+        }
+        m_Wake.notify_all();
+
+        for(size_t i = 0; i < m_Workers.size(); i++) {
+            if(m_Workers[i]->Thread.joinable())
+                m_Workers[i]->Thread.join();
+            delete m_Workers[i];
+        }
+    }
+
+    size_t GetThreads() const
+    {
+        return m_Workers.size();
+    }
+
+    // Counts ASTNode::Size again for every operator of the tree, e.g. after
+    // the Optimizer.
+    static void Annotate(ASTNode* ast)
+    {
+        struct Frame {
+            ASTNode* Node;
+            bool     Expanded;
+        };
+
+        std::vector<Frame> stack;
+        Frame root = { ast, false };
+        stack.push_back(root);
+
+        while(!stack.empty()) {
+            Frame frame = stack.back();
+            stack.pop_back();
+
+            ASTNode* node = frame.Node;
+            if(node == NULL || node->Type == NumberValue || node->Type == Variable)
+                continue;
+
+            if(frame.Expanded) {
+                node->CountSize();
+                continue;
+            }
+
+            Frame self = { node, true }, left = { node->Left, false }, right = { node->Right, false };
+            stack.push_back(self);
+            stack.push_back(right);
+            stack.push_back(left);
+        }
+    }
+
+    // Evaluates the tree, as Evaluator::Evaluate() does. One evaluation at
+    // a time.
+    double Evaluate(ASTNode* ast, const double* slots = NULL)
+    {
+        if(ast == NULL)
+            throw EvaluatorException("Incorrect abstract syntax tree");
+
+        m_Slots = slots;
+        if(m_Workers.size() == 1 || ASTNode::SubtreeSize(ast) < m_Grain)
+            return m_Workers[0]->Eval.Evaluate(ast, slots);
+
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            m_Running = true;
+            m_Busy.store(true, std::memory_order_release);
+        }
+        m_Wake.notify_all();
+
+        double value;
+        try {
+            value = Run(0, ast, 0);
+        }
+        catch(...) {
+            Finish();
+            throw;
+        }
+
+        Finish();
+        return value;
+    }
+};
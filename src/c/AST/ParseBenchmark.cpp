@@ -0,0 +1,424 @@
+/*
+ * ParseBenchmark.cpp - Tokenize, validate, parse, evaluate, teardown and
+ * one-shot throughput,
+ * for the C++ Parser/Evaluator and for the C evaluator in '../ast'.
+ *
+ * Build: gcc -O2 -DEVALEXP_NO_MAIN -c ../ast/evalexp.c
+ *        g++ -O2 -std=c++11 -o parsebench ParseBenchmark.cpp evalexp.o
+ *
+ * Usage: parsebench [name=value ...], e.g.
+ *
+ *        parsebench seed=7 count=100000 terms=32 depth=8 mix=1,1,1,1
+ *
+ *        seed      the generator's seed                    (1)
+ *        count     expressions in the corpus               (100000)
+ *        repeat    runs of each phase; the fastest counts  (5)
+ *        terms     numbers per expression                  (8)
+ *        depth     most parentheses/minuses around one     (4)
+ *        mix       weights of + - * /                      (4,4,3,2)
+ *        negate    percent of numbers with a unary minus   (10)
+ *        parens    percent of subexpressions in parens     (30)
+ *        spaces    percent of tokens followed by a blank   (20)
+ *        literals  weights of integer, decimal and long    (6,3,1)
+ *
+ * Note: The corpus comes from ExpressionGenerator, so a seed and a set of
+ *       options always time the same expressions. Each phase runs over the
+ *       whole corpus:
+ *
+ *        tokenize  the tokenizer alone, once with each classifier of the
+ *                  Lexer that the CPU has (the variant)
+ *        validate  the syntax check alone (Validator, evalexp_validate());
+ *                  the checksum counts the malformed expressions
+ *        parse     building all the trees, which are kept
+ *        evaluate  evaluating the kept trees
+ *        teardown  getting rid of them: 'delete' per tree, or one reset of
+ *                  the arena or the C context
+ *        oneshot   parse, evaluate and forget each expression in turn: with
+ *                  'new' and 'delete', with the arena reset every time, or
+ *                  directly with the ValueParser, which builds no tree
+ *
+ *       The times are those of the fastest of 'repeat' runs, the memory
+ *       figures those of the first run, starting from nothing: 'allocs' are
+ *       the calls to operator new plus the blocks the arena or the C
+ *       context take, 'bytes' their sizes. The result is one JSON object on
+ *       stdout.
+ */
+
+#include "Parser.h"
+#include "Validator.h"
+#include "Evaluator.h"
+#include "ValueParser.h"
+#include "ExpressionGenerator.h"
+#include "../ast/ast.h"
+#include <new>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Note: operator delete has to match, so both go to malloc and free, which
+//       GCC's -Wmismatched-new-delete cannot see.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#  pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+static size_t g_Allocations;
+static size_t g_AllocatedBytes;
+
+void* operator new(size_t size)
+{
+    g_Allocations++;
+    g_AllocatedBytes += size;
+
+    void* p = malloc(size ? size : 1);
+    if(p == NULL)
+        throw std::bad_alloc();
+
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+struct Measurement {
+    const char* Implementation;
+    const char* Phase;
+    const char* Variant;
+    double      Nanoseconds;        // per expression
+    double      Bytes;              // per expression
+    double      Allocations;        // per expression
+    double      Checksum;
+};
+
+static std::vector<Measurement> g_Results;
+
+// Memory taken from the system so far, besides operator new.
+struct Usage {
+    size_t Allocations;
+    size_t Bytes;
+};
+
+static Usage Snapshot(size_t blocks = 0, size_t blockBytes = 0)
+{
+    Usage usage = { g_Allocations + blocks, g_AllocatedBytes + blockBytes };
+    return usage;
+}
+
+// Runs 'phase' (which returns a checksum) 'repeat' times, with 'prepare'
+// before each run, untimed. 'usage' gives the memory used so far.
+template<class Prepare, class Phase, class Memory>
+static void Measure(const char* implementation, const char* phase, const char* variant,
+                    const std::vector<std::string>& corpus, int repeat,
+                    Prepare prepare, Phase run, Memory usage)
+{
+    double best = 0, checksum = 0;
+    Usage before = {0, 0}, after = {0, 0};
+
+    for(int r = 0; r < repeat; r++) {
+        prepare();
+
+        if(r == 0)
+            before = usage();
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        checksum = run();
+        std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+
+        if(r == 0)
+            after = usage();
+
+        double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+        if(r == 0 || ns < best)
+            best = ns;
+    }
+
+    double n = (double)corpus.size();
+    Measurement m = {
+        implementation, phase, variant, best / n,
+        (after.Bytes - before.Bytes) / n, (after.Allocations - before.Allocations) / n,
+        checksum
+    };
+    g_Results.push_back(m);
+}
+
+static void Nothing()
+{
+}
+
+static void BenchCpp(const std::vector<std::string>& corpus, int repeat)
+{
+    size_t count = corpus.size();
+    std::vector<ASTNode*> trees(count, (ASTNode*)NULL);
+    Parser parser;
+    Evaluator eval;
+
+    for(int level = Lexer::Scalar; level < Lexer::Best; level++) {
+        parser.GetLexer().SetLevel((Lexer::Level)level);
+        if(parser.GetLexer().GetLevel() != level)
+            continue;
+
+        Measure("c++", "tokenize", Lexer::LevelName((Lexer::Level)level), corpus, repeat, Nothing, [&]() {
+            double tokens = 0;
+            for(size_t i = 0; i < count; i++)
+                tokens += parser.Tokenize(corpus[i].c_str());
+            return tokens;
+        }, []() { return Snapshot(); });
+    }
+    parser.GetLexer().SetLevel(Lexer::Best);
+
+    Validator validator;
+    Measure("c++", "validate", "", corpus, repeat, Nothing, [&]() {
+        double malformed = 0;
+        ErrorInfo error;
+        for(size_t i = 0; i < count; i++)
+            malformed += !validator.Validate(corpus[i].c_str(), error);
+        return malformed;
+    }, []() { return Snapshot(); });
+
+    // Note: Each parse run needs the trees of the previous one gone, and
+    //       each teardown run a fresh set of trees; that part is untimed.
+    std::function<void()> deleteTrees = [&]() {
+        for(size_t i = 0; i < count; i++) {
+            delete trees[i];
+            trees[i] = NULL;
+        }
+    };
+    std::function<void()> parseTrees = [&]() {
+        deleteTrees();
+        for(size_t i = 0; i < count; i++)
+            trees[i] = parser.Parse(corpus[i].c_str());
+    };
+
+    Measure("c++", "parse", "new", corpus, repeat, deleteTrees, [&]() {
+        for(size_t i = 0; i < count; i++)
+            trees[i] = parser.Parse(corpus[i].c_str());
+        return 0.0;
+    }, []() { return Snapshot(); });
+
+    Measure("c++", "evaluate", "recursive", corpus, repeat, Nothing, [&]() {
+        double sum = 0;
+        for(size_t i = 0; i < count; i++)
+            sum += eval.Evaluate(trees[i]);
+        return sum;
+    }, []() { return Snapshot(); });
+
+    Measure("c++", "teardown", "delete", corpus, repeat, parseTrees, [&]() {
+        for(size_t i = 0; i < count; i++) {
+            delete trees[i];
+            trees[i] = NULL;
+        }
+        return 0.0;
+    }, []() { return Snapshot(); });
+
+    NodeArena arena;
+    Parser arenaParser(&arena);
+    size_t blockSize = 64 * 1024;
+
+    Measure("c++", "parse", "arena", corpus, repeat, [&]() { arena.Reset(); }, [&]() {
+        for(size_t i = 0; i < count; i++)
+            trees[i] = arenaParser.Parse(corpus[i].c_str());
+        return 0.0;
+    }, [&]() { return Snapshot(arena.Reserved() / blockSize, arena.Reserved()); });
+
+    Measure("c++", "teardown", "arena", corpus, repeat, [&]() {
+        arena.Reset();
+        for(size_t i = 0; i < count; i++)
+            trees[i] = arenaParser.Parse(corpus[i].c_str());
+    }, [&]() {
+        arena.Reset();
+        return 0.0;
+    }, [&]() { return Snapshot(arena.Reserved() / blockSize, arena.Reserved()); });
+
+    for(size_t i = 0; i < count; i++)
+        trees[i] = NULL;
+
+    Measure("c++", "oneshot", "tree", corpus, repeat, Nothing, [&]() {
+        double sum = 0;
+        for(size_t i = 0; i < count; i++) {
+            ASTNode* ast = parser.Parse(corpus[i].c_str());
+            sum += eval.Evaluate(ast);
+            delete ast;
+        }
+        return sum;
+    }, []() { return Snapshot(); });
+
+    Measure("c++", "oneshot", "arena", corpus, repeat, Nothing, [&]() {
+        double sum = 0;
+        for(size_t i = 0; i < count; i++) {
+            arena.Reset();
+            sum += eval.Evaluate(arenaParser.Parse(corpus[i].c_str()));
+        }
+        return sum;
+    }, [&]() { return Snapshot(arena.Reserved() / blockSize, arena.Reserved()); });
+
+    ValueParser valueParser;
+    Measure("c++", "oneshot", "direct", corpus, repeat, Nothing, [&]() {
+        double sum = 0;
+        for(size_t i = 0; i < count; i++)
+            sum += valueParser.Evaluate(corpus[i].c_str());
+        return sum;
+    }, []() { return Snapshot(); });
+}
+
+static void BenchC(const std::vector<std::string>& corpus, int repeat)
+{
+    size_t count = corpus.size();
+    std::vector<Astnode*> trees(count, (Astnode*)NULL);
+    evalexp_ctx ctx;
+    evalexp_init(&ctx);
+
+    std::function<Usage()> usage = [&]() {
+        return Snapshot(ctx.allocations, ctx.allocations * sizeof(Astblock));
+    };
+
+    Measure("c", "tokenize", "", corpus, repeat, Nothing, [&]() {
+        double tokens = 0;
+        for(size_t i = 0; i < count; i++)
+            tokens += evalexp_tokenize(&ctx, corpus[i].c_str());
+        return tokens;
+    }, usage);
+
+    Measure("c", "validate", "", corpus, repeat, Nothing, [&]() {
+        double malformed = 0;
+        for(size_t i = 0; i < count; i++)
+            malformed += evalexp_validate(corpus[i].c_str()) >= 0;
+        return malformed;
+    }, usage);
+
+    std::function<void()> parseTrees = [&]() {
+        evalexp_reset(&ctx);
+        for(size_t i = 0; i < count; i++)
+            trees[i] = evalexp_parse(&ctx, corpus[i].c_str());
+    };
+
+    Measure("c", "parse", "arena", corpus, repeat, [&]() { evalexp_reset(&ctx); }, [&]() {
+        for(size_t i = 0; i < count; i++)
+            trees[i] = evalexp_parse(&ctx, corpus[i].c_str());
+        return 0.0;
+    }, usage);
+
+    Measure("c", "evaluate", "recursive", corpus, repeat, Nothing, [&]() {
+        double sum = 0;
+        for(size_t i = 0; i < count; i++)
+            sum += evalexp_eval(&ctx, trees[i]);
+        return sum;
+    }, usage);
+
+    Measure("c", "teardown", "arena", corpus, repeat, parseTrees, [&]() {
+        evalexp_reset(&ctx);
+        return 0.0;
+    }, usage);
+
+    evalexp_destroy(&ctx);
+}
+
+// "a,b,c" into up to 'count' numbers.
+static void ParseList(const char* text, unsigned* values, int count)
+{
+    for(int i = 0; i < count && *text; i++) {
+        values[i] = (unsigned)strtoul(text, (char**)&text, 10);
+        if(*text == ',')
+            text++;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    ExpressionGenerator::Options options;
+    unsigned long long seed = 1;
+    size_t count = 100000;
+    int repeat = 5;
+
+    for(int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = strchr(arg, '=');
+        if(value == NULL) {
+            fprintf(stderr, "Expected name=value, got '%s'\n", arg);
+            return 1;
+        }
+        std::string name(arg, value++ - arg);
+
+        if(name == "seed")          seed = strtoull(value, NULL, 10);
+        else if(name == "count")    count = (size_t)strtoull(value, NULL, 10);
+        else if(name == "repeat")   repeat = atoi(value);
+        else if(name == "terms")    options.Terms = (unsigned)atoi(value);
+        else if(name == "depth")    options.MaxDepth = (unsigned)atoi(value);
+        else if(name == "negate")   options.Negate = (unsigned)atoi(value);
+        else if(name == "parens")   options.Parenthesize = (unsigned)atoi(value);
+        else if(name == "spaces")   options.Spaces = (unsigned)atoi(value);
+        else if(name == "mix") {
+            unsigned mix[4] = { 0, 0, 0, 0 };
+            ParseList(value, mix, 4);
+            options.Plus = mix[0]; options.Minus = mix[1];
+            options.Mul = mix[2]; options.Div = mix[3];
+        }
+        else if(name == "literals") {
+            unsigned literals[3] = { 0, 0, 0 };
+            ParseList(value, literals, 3);
+            options.Integers = literals[0];
+            options.Decimals = literals[1];
+            options.Long = literals[2];
+        }
+        else {
+            fprintf(stderr, "Unknown option '%s'\n", name.c_str());
+            return 1;
+        }
+    }
+
+    if(count == 0 || repeat < 1) {
+        fprintf(stderr, "count and repeat must be at least 1\n");
+        return 1;
+    }
+
+    ExpressionGenerator generator(seed, options);
+    std::vector<std::string> corpus(count);
+    size_t bytes = 0;
+    for(size_t i = 0; i < count; i++) {
+        generator.Generate(corpus[i]);
+        bytes += corpus[i].size();
+    }
+
+    BenchCpp(corpus, repeat);
+    BenchC(corpus, repeat);
+
+    printf("{\n");
+    printf("  \"generator\": {\"seed\": %llu, \"terms\": %u, \"depth\": %u, "
+           "\"mix\": [%u, %u, %u, %u], \"negate\": %u, \"parens\": %u, \"spaces\": %u, "
+           "\"literals\": [%u, %u, %u]},\n",
+           seed, options.Terms, options.MaxDepth,
+           options.Plus, options.Minus, options.Mul, options.Div,
+           options.Negate, options.Parenthesize, options.Spaces,
+           options.Integers, options.Decimals, options.Long);
+    printf("  \"corpus\": {\"expressions\": %zu, \"bytes\": %zu, \"repeat\": %d},\n",
+           count, bytes, repeat);
+    printf("  \"results\": [\n");
+    for(size_t i = 0; i < g_Results.size(); i++) {
+        const Measurement& m = g_Results[i];
+
+        // JSON has no infinities or NaNs.
+        char checksum[32] = "null";
+        if(isfinite(m.Checksum))
+            snprintf(checksum, sizeof(checksum), "%.17g", m.Checksum);
+
+        printf("    {\"implementation\": \"%s\", \"phase\": \"%s\", \"variant\": \"%s\", "
+               "\"ns_per_expr\": %.2f, \"bytes_per_expr\": %.2f, \"allocs_per_expr\": %.4f, "
+               "\"checksum\": %s}%s\n",
+               m.Implementation, m.Phase, m.Variant, m.Nanoseconds, m.Bytes,
+               m.Allocations, checksum, i + 1 < g_Results.size() ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+
+    return 0;
+}
@@ -39,32 +39,58 @@
  * We build the tree by inserting semantic actions and adding nodes, according
  * to the following rules:
  *
- *  ---------------------------------------------------------------------------
- * |PRODUCTION              |SEMANTIC RULE                                     |
- *  ---------------------------------------------------------------------------
- * |EXP    -> TERM EXP1     |EXP.node    = mknode(Plus, TERM.node, EXP1.node)  |
- * |EXP1   -> + TERM EXP1   |EXP1.node   = mknode(Plus, EXP1.node, TERM.node)  |
- * |EXP1   -> - TERM EXP1   |EXP1.node   = mknode(Minus, EXP1.node, TERM.node) |
- * |EXP1   -> epsilon       |EXP1.node   = mknode(Number, 0)                   |
- * |TERM   -> FACTOR TERM1  |TERM.node   = mknode(Mul, FACTOR.node, TERM1.node)|
- * |TERM1  -> * FACTOR TERM1|TERM1.node  = mknode(Mul, TERM1.node, FACTOR.node)|
- * |TERM1  -> / FACTOR TERM1|TERM1.node  = mknode(Div, TERM1.node, FACTOR.node)|
- * |TERM1  -> epsilon       |TERM1.node  = mknode(Number, 1)                   |
- * |FACTOR -> ( EXP )       |FACTOR.node = mknode(EXP.node)                    |
- * |FACTOR -> - EXP         |FACTOR.node = mknode(UnaryMinus, EXP.node)        |
- * |FACTOR -> number        |FACTOR.node = mknode(Number, number)              |
- *  ---------------------------------------------------------------------------
+ *  --------------------------------------------------------------------------
+ * |PRODUCTION               |SEMANTIC RULE                                 |
+ *  --------------------------------------------------------------------------
+ * |EXP    -> TERM EXP1      |EXP1.in = TERM.node; EXP.node = EXP1.node     |
+ * |EXP1   -> + TERM EXP1'   |EXP1'.in = mknode(Plus, EXP1.in, TERM.node)   |
+ * |EXP1   -> - TERM EXP1'   |EXP1'.in = mknode(Minus, EXP1.in, TERM.node)  |
+ * |EXP1   -> epsilon        |EXP1.node = EXP1.in                           |
+ * |TERM   -> FACTOR TERM1   |TERM1.in = FACTOR.node; TERM.node = TERM1.node|
+ * |TERM1  -> * FACTOR TERM1'|TERM1'.in = mknode(Mul, TERM1.in, FACTOR.node)|
+ * |TERM1  -> / FACTOR TERM1'|TERM1'.in = mknode(Div, TERM1.in, FACTOR.node)|
+ * |TERM1  -> epsilon        |TERM1.node = TERM1.in                         |
+ * |FACTOR -> ( EXP )        |FACTOR.node = EXP.node                        |
+ * |FACTOR -> - EXP          |FACTOR.node = mknode(UnaryMinus, EXP.node)    |
+ * |FACTOR -> number         |FACTOR.node = mknode(Number, number)          |
+ *  --------------------------------------------------------------------------
  *
- * Based on these rules, we will modify the AST somehwat, with some additional
- * nodes for the + and * operators (i.e., on the left, a leaf node with a
- * neutral element for the operation (0 for + and 1 for *), and on the right,
- * a node corresponding to a TERM or a FACTOR). This will not affect the
- * evaluation.
+ * That is, the operand built so far is handed down into EXP1 and TERM1 (the
+ * inherited attribute 'in'), and each operator wraps it as its left child.
+ * This gives the left associative tree directly, e.g. '1-2-3' is (1-2)-3,
+ * with exactly one node per number and per operator.
+ *
+ * Note: The values are not always the same as with the older rules, which
+ *       put a neutral element into every EXP1 and TERM1 (Number 0 and
+ *       Number 1) and grouped a TERM as FACTOR * TERM1:
+ *
+ *       - A quotient was computed as a*(1/b), i.e. rounded twice. It is now
+ *         the correctly rounded a/b, so '92/3' is 0x403eaaaaaaaaaaab instead
+ *         of 0x403eaaaaaaaaaaaa, and '7/5' is 1.4 instead of 1.4000000000000001.
+ *       - The '+ 0' and '* 1' wrappers turned a negative zero into +0.0. They
+ *         are gone, so '-0', '-6*0' and '-0/93' are now -0.0.
+ *
+ *       The C version ('../ast/evalexp.c') still builds the older tree, so
+ *       the two can differ in these cases.
+ *
+ * Note: The parser itself does not know what a node is. Every semantic
+ *       action above goes through a builder, so the same grammar code can
+ *       produce the pointer tree (TreeBuilder, below) or other forms, e.g.
+ *       the postfix array in 'Postfix.h'. Since the children are always
+ *       built before their parent, the builder sees the nodes in postfix
+ *       order.
  */
 
-#include <sstream>
+#ifndef PARSER_H
+#  define PARSER_H 1
+#endif
+
+#include <string>
+#include <vector>
 #include <assert.h>
 #include <stdexcept>
+#include <ctype.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -72,6 +98,18 @@
 #  include "AST.h"
 #endif
 
+#ifndef ARENA_H
+#  include "Arena.h"
+#endif
+
+#ifndef SYMBOLS_H
+#  include "Symbols.h"
+#endif
+
+#ifndef LEXER_H
+#  include "Lexer.h"
+#endif
+
 // Exception class
 // Note: I had to derive from 'std::runtime_error' which *will* take
 //       a reference to a 'std::string'. 
@@ -85,217 +123,550 @@ public:
        m_Pos(pos)
        {
        }
+
+   int GetPosition() const
+   {
+       return m_Pos;
+   }
 };
 
-class Parser
+// ErrorInfo - why a Parse() call without exceptions failed.
+// Note: Filling it in costs three stores; the message is only put together
+//       when Format() or Message() is called, e.g. for the inputs that are
+//       actually reported.
+struct ErrorInfo
 {
-    Token m_crtToken;
-    const char* m_Text;
-    size_t m_Index;
-
-private:
-
-    ASTNode* Expression()
+    enum ErrorCode {
+        None,
+        UnexpectedToken,        // Symbol: the offending character
+        ExpectedToken,          // Symbol: the character that was expected
+        NestedTooDeeply,
+        TextTooLong             // Position: Lexer::MaxLength
+    };
+
+    ErrorCode   Code;
+    size_t      Position;
+    char        Symbol;         // 0 at the end of the text
+
+    ErrorInfo():
+        Code(None), Position(0), Symbol(0)
     {
-        ASTNode* tnode = Term();
-        ASTNode* e1node = Expression1();
-
-        return CreateNode(OperatorPlus, tnode, e1node);
     }
 
-    ASTNode* Expression1()
+    // Writes the message of the ParserException to 'buffer', as snprintf()
+    // does, and returns its length. An unexpected Symbol of 0 is the end
+    // of the text, and said so, as in evalexp.c.
+    size_t Format(char* buffer, size_t size) const
     {
-        ASTNode* tnode;
-        ASTNode* e1node;
-
-        switch(m_crtToken.Type) {
-        case Plus:
-            GetNextToken();
-            tnode = Term();
-            e1node = Expression1();
-
-            return CreateNode(OperatorPlus, e1node, tnode);
-
-        case Minus:
-            GetNextToken();
-            tnode = Term();
-            e1node = Expression1();
-
-            return CreateNode(OperatorMinus, e1node, tnode);
+        int length;
+        switch(Code) {
+        case UnexpectedToken:
+            if(Symbol == 0)
+                length = snprintf(buffer, size, "Unexpected end of text at position %zu", Position);
+            else
+                length = snprintf(buffer, size, "Unexpected token '%c' at position %zu", Symbol, Position);
+            break;
+        case ExpectedToken:
+            length = snprintf(buffer, size, "Expected token '%c' at position %zu", Symbol, Position);
+            break;
+        case NestedTooDeeply:
+            length = snprintf(buffer, size, "Expression nested too deeply at position %zu", Position);
+            break;
+        case TextTooLong:
+            length = snprintf(buffer, size, "Text too long at position %zu", Position);
+            break;
+        default:
+            length = snprintf(buffer, size, "No error");
+            break;
         }
 
-        return CreateNodeNumber(0);
+        return length > 0 ? (size_t)length : 0;
     }
 
-    ASTNode* Term()
+    std::string Message() const
     {
-        ASTNode* fnode = Factor();
-        ASTNode* t1node = Term1();
+        char buffer[80];
+        size_t length = Format(buffer, sizeof(buffer));
 
-        return CreateNode(OperatorMul, fnode, t1node);
+        return std::string(buffer, length < sizeof(buffer) ? length : sizeof(buffer) - 1);
     }
+};
 
-    ASTNode* Term1()
-    {
-        ASTNode* fnode;
-        ASTNode* t1node;
-
-        switch(m_crtToken.Type) {
-        case Mul:
-            GetNextToken();
-            fnode = Factor();
-            t1node = Term1();
-            return CreateNode(OperatorMul, t1node, fnode);
-
-        case Div:
-            GetNextToken();
-            fnode = Factor();
-            t1node = Term1();
-            return CreateNode(OperatorDiv, t1node, fnode);
-        }
-        
-        return CreateNodeNumber(1);
-    }
+// TreeBuilder - the builder for the ASTNode tree.
+class TreeBuilder
+{
+    NodeArena* m_Arena;
 
-    ASTNode* Factor()
+    // Note: With an arena, the nodes are placed in it and the tree must not
+    //       be deleted; without one, each node comes from 'new' as before.
+    ASTNode* NewNode()
     {
-        ASTNode* node;
-        switch(m_crtToken.Type) {
-        case OpenParenthesis:
-            GetNextToken();
-            node = Expression();
-            Match(')');
-            return node;
-
-        case Minus:
-            GetNextToken();
-            node = Factor();
-            return CreateUnaryNode(node);
+        if(m_Arena != NULL)
+            return m_Arena->Create<ASTNode>();
 
-        case Number: {
-            double value = m_crtToken.Value;
-            GetNextToken();
-            return CreateNodeNumber(value);
-        }
-
-        default: {
-            std::stringstream sstr;
-            sstr << "Unexpected token '" << m_crtToken.Symbol << "' at position " << m_Index;
-            throw ParserException(sstr.str(), m_Index);
-        }
-        }
+        return new ASTNode;
     }
 
     ASTNode* CreateNode(ASTNodeType type, ASTNode* left, ASTNode* right)
     {
-        ASTNode* node = new ASTNode;
+        ASTNode* node = NewNode();
         node->Type = type;
         node->Left = left;
         node->Right = right;
+        node->CountSize();
 
         return node;
     }
 
     ASTNode* CreateUnaryNode(ASTNode* left) 
     {
-        ASTNode* node = new ASTNode;
+        ASTNode* node = NewNode();
         node->Type = UnaryMinus;
         node->Left = left;
         node->Right = NULL;
+        node->CountSize();
 
         return node;
     }
 
     ASTNode* CreateNodeNumber(double value)
     {
-        ASTNode* node = new ASTNode;
+        ASTNode* node = NewNode();
         node->Type = NumberValue;
         node->Value = value;
 
         return node;
     }
 
-    void Match(char expected)
+    ASTNode* CreateNodeVariable(unsigned slot)
     {
-        if(m_Text[m_Index-1] == expected)
-            GetNextToken();
-        else {
-            std::stringstream sstr;
-            sstr << "Expected token '" << expected << "' at position " << m_Index;
-            throw ParserException(sstr.str(), m_Index);
-        }
+        ASTNode* node = NewNode();
+        node->Type = ::Variable;
+        node->Slot = slot;
+
+        return node;
     }
 
-    void SkipWhitespaces()
+public:
+    typedef ASTNode* Node;
+
+    TreeBuilder(NodeArena* arena = NULL):
+        m_Arena(arena)
     {
-        while(isspace(m_Text[m_Index])) m_Index++;
     }
 
-    void GetNextToken()
+    void Begin()
     {
-        SkipWhitespaces();
+    }
 
-        m_crtToken.Value = 0;
-        m_crtToken.Symbol = 0;
+    // A subtree left over from a failed parse.
+    void Discard(Node node)
+    {
+        if(m_Arena == NULL)
+            delete node;
+    }
 
-        if(m_Text[m_Index] == 0) {
-            m_crtToken.Type = EndOfText;
-            return;
-        }
+    Node Binary(ASTNodeType type, Node left, Node right)
+    {
+        return CreateNode(type, left, right);
+    }
 
-        if(isdigit(m_Text[m_Index])) {
-            m_crtToken.Type = Number;
-            m_crtToken.Value = GetNumber();
-            return;
-        }
+    Node Unary(Node left)
+    {
+        return CreateUnaryNode(left);
+    }
+
+    Node Number(double value)
+    {
+        return CreateNodeNumber(value);
+    }
 
-        m_crtToken.Type = Error;
+    Node Variable(unsigned slot)
+    {
+        return CreateNodeVariable(slot);
+    }
+};
+
+template<class Builder>
+class BasicParser
+{
+    typedef typename Builder::Node Node;
 
-        switch(m_Text[m_Index]) {
-        case '+': m_crtToken.Type = Plus; break;
-        case '-': m_crtToken.Type = Minus; break;
-        case '*': m_crtToken.Type = Mul; break;
-        case '/': m_crtToken.Type = Div; break;
-        case '(': m_crtToken.Type = OpenParenthesis; break;
-        case ')': m_crtToken.Type = ClosedParenthesis; break;
+    Token m_crtToken;
+    const char* m_Text;
+    size_t m_Length;
+    size_t m_Index;
+    Lexer m_Lexer;
+    size_t m_Next;
+    Builder m_Builder;
+    SymbolTable* m_Symbols;
+    std::vector<ASTNodeType> m_Pending;
+    std::vector<Node> m_Operands;
+    size_t m_Depth;
+    size_t m_MaxDepth;
+    ErrorInfo m_Error;
+    bool m_Strict;
+    bool m_Names;
+
+private:
+
+    // The operators still waiting for their right operand, together with
+    // the open parentheses and unary minuses: see Expression().
+    static int Precedence(ASTNodeType type)
+    {
+        switch(type) {
+        case OperatorPlus:
+        case OperatorMinus: return 1;
+        case OperatorMul:
+        case OperatorDiv:   return 2;
+        default:            return 0;
         }
+    }
 
-        if(m_crtToken.Type != Error) {
-            m_crtToken.Symbol = m_Text[m_Index];
-            m_Index++;
+    static ASTNodeType BinaryOperator(TokenType type)
+    {
+        switch(type) {
+        case Plus:  return OperatorPlus;
+        case Minus: return OperatorMinus;
+        case Mul:   return OperatorMul;
+        case Div:   return OperatorDiv;
+        default:    return Undefined;
         }
-        else {
-            std::stringstream sstr;
-            sstr << "Unexpected token '" << m_Text[m_Index] << "' at position " << m_Index;
-            throw ParserException(sstr.str(), m_Index);
+    }
+
+    // Records an error at the current position; returns false to be
+    // passed up.
+    bool Fail(ErrorInfo::ErrorCode code, char symbol)
+    {
+        m_Error.Code = code;
+        m_Error.Position = m_Index;
+        m_Error.Symbol = symbol;
+
+        return false;
+    }
+
+    bool Nest(ASTNodeType marker)
+    {
+        if(m_MaxDepth != 0 && ++m_Depth > m_MaxDepth)
+            return Fail(ErrorInfo::NestedTooDeeply, 0);
+
+        m_Pending.push_back(marker);
+        return GetNextToken();
+    }
+
+    // Note: This is the EXP/TERM/FACTOR recursive descent turned inside
+    //       out. Instead of recursing into FACTOR for every '(' and unary
+    //       '-', and into TERM and FACTOR for every operand, the pending
+    //       work goes on two explicit stacks, m_Pending (operators, with
+    //       Undefined marking an open parenthesis) and m_Operands, so the
+    //       native stack depth stays the same for any input.
+    //
+    //       An operator first combines all pending operators of the same or
+    //       higher precedence (giving the left associative tree), and the
+    //       end of an EXP -- anything that is not an operator -- combines
+    //       all of them up to the innermost open parenthesis. The nodes are
+    //       created in exactly the order, and the errors are raised at
+    //       exactly the positions, of the recursive version.
+    //
+    //       On an error, every node built so far is on m_Operands.
+    bool Expression(Node& result)
+    {
+        m_Pending.clear();
+        m_Operands.clear();
+        m_Depth = 0;
+
+        for(;;) {
+            // FACTOR -> ( EXP ) | - FACTOR: remember them for later.
+            while(m_crtToken.Type == OpenParenthesis || m_crtToken.Type == Minus)
+                if(!Nest(m_crtToken.Type == OpenParenthesis ? Undefined : UnaryMinus))
+                    return false;
+
+            Node node;
+            switch(m_crtToken.Type) {
+            case Number: {
+                double value = m_crtToken.Value;
+                if(!GetNextToken())
+                    return false;
+                node = m_Builder.Number(value);
+                break;
+            }
+
+            case Identifier: {
+                unsigned slot = m_crtToken.Slot;
+                if(!GetNextToken())
+                    return false;
+                node = m_Builder.Variable(slot);
+                break;
+            }
+
+            default:
+                return Fail(ErrorInfo::UnexpectedToken, m_crtToken.Symbol);
+            }
+
+            for(;;) {
+                // 'node' is a complete FACTOR: apply its unary minuses.
+                while(!m_Pending.empty() && m_Pending.back() == UnaryMinus) {
+                    m_Pending.pop_back();
+                    m_Depth--;
+                    node = m_Builder.Unary(node);
+                }
+
+                ASTNodeType op = BinaryOperator(m_crtToken.Type);
+                int precedence = Precedence(op);
+
+                while(!m_Pending.empty() && Precedence(m_Pending.back()) >= precedence
+                      && m_Pending.back() != Undefined) {
+                    Node left = m_Operands.back();
+                    m_Operands.pop_back();
+                    node = m_Builder.Binary(m_Pending.back(), left, node);
+                    m_Pending.pop_back();
+                }
+
+                if(op != Undefined) {
+                    m_Operands.push_back(node);
+                    m_Pending.push_back(op);
+                    if(!GetNextToken())
+                        return false;
+                    break;
+                }
+
+                // The end of an EXP: either the whole input, or '( EXP )'.
+                if(m_Pending.empty()) {
+                    result = node;
+                    return true;
+                }
+
+                if(!Match(')')) {
+                    m_Operands.push_back(node);
+                    return false;
+                }
+                m_Pending.pop_back();
+                m_Depth--;
+            }
         }
     }
 
-    double GetNumber()
+    // Note: Parse() checks the character before m_Index, so at the end of
+    //       '((1)' the last ')' counts twice; ParseStrict() wants the token.
+    bool Match(char expected)
+    {
+        if(m_Strict ? m_crtToken.Symbol == expected : At(m_Index-1) == expected)
+            return GetNextToken();
+
+        return Fail(ErrorInfo::ExpectedToken, expected);
+    }
+
+    // The character at 'index', or 0 at and past the end of the text.
+    char At(size_t index) const
     {
-        SkipWhitespaces();
-        
-        int index = m_Index;
-        while(isdigit(m_Text[m_Index])) m_Index++;
-        if(m_Text[m_Index] == '.') m_Index++;
-        while(isdigit(m_Text[m_Index])) m_Index++;
+        return index < m_Length ? m_Text[index] : 0;
+    }
+
+    // Note: The tokens come from the lexer's array; m_Index is where the
+    //       current one ends, as if the text had been read up to there.
+    bool GetNextToken()
+    {
+        const LexToken& token = m_Lexer.Tokens()[m_Next];
+        m_Index = token.End;
+
+        m_crtToken.Type = (TokenType)token.Type;
+        m_crtToken.Value = 0;
+        m_crtToken.Symbol = token.Symbol;
 
-        if(m_Index - index == 0)
-            throw ParserException("Number expected but not found!", m_Index);
+        switch(token.Type) {
+        case EndOfText:
+            return true;
 
-        char buffer[32] = {0};
-        memcpy(buffer, &m_Text[index], m_Index - index);
+        case Number:
+            m_crtToken.Value = token.Value;
+            break;
 
-        return atof(buffer);
+        case Identifier:
+            m_crtToken.Slot = m_Symbols != NULL ? m_Symbols->Declare(&m_Text[token.Start], token.End - token.Start) : 0;
+            break;
+
+        case Error:
+            return Fail(ErrorInfo::UnexpectedToken, token.Symbol);
+        }
+
+        m_Next++;
+        return true;
     }
 
-public:
-    ASTNode* Parse(const char* text)
+    bool Scan(const char* text, size_t length)
     {
         m_Text = text;
+        m_Length = m_Lexer.Scan(text, length, m_Symbols != NULL || m_Names);
         m_Index = 0;
-        GetNextToken();
+        m_Next = 0;
+        m_Error = ErrorInfo();
+
+        if(m_Length > Lexer::MaxLength) {
+            m_Index = Lexer::MaxLength;
+            return Fail(ErrorInfo::TextTooLong, 0);
+        }
+
+        return true;
+    }
+
+    void Throw() const
+    {
+        throw ParserException(m_Error.Message(), (int)m_Error.Position);
+    }
+
+public:
+    // See SetMaxDepth().
+    enum { DefaultMaxDepth = 100000 };
+
+    // With a symbol table, the parser also accepts variables, i.e. names
+    // matching [A-Za-z_][A-Za-z0-9_]*, and resolves them to slots in it.
+    BasicParser(const Builder& builder = Builder(), SymbolTable* symbols = NULL):
+        m_Text(NULL), m_Length(0), m_Index(0), m_Next(0), m_Builder(builder), m_Symbols(symbols),
+        m_Depth(0), m_MaxDepth(DefaultMaxDepth), m_Strict(false), m_Names(false)
+    {
+    }
+
+    // The deepest nesting of parentheses and unary minuses accepted, or 0
+    // for no limit. Long operator chains do not count against it.
+    void SetMaxDepth(size_t depth)
+    {
+        m_MaxDepth = depth;
+    }
+
+    void SetSymbols(SymbolTable* symbols)
+    {
+        m_Symbols = symbols;
+    }
+
+    SymbolTable* GetSymbols() const
+    {
+        return m_Symbols;
+    }
+
+    // Accepts variables even without a symbol table, but declares nothing:
+    // they all get slot 0. For syntax checks, see Validator.h.
+    void SetNames(bool names)
+    {
+        m_Names = names;
+    }
+
+    Builder& GetBuilder()
+    {
+        return m_Builder;
+    }
+
+    // E.g. 'GetLexer().SetLevel(Lexer::Scalar)' to compare the classifiers.
+    Lexer& GetLexer()
+    {
+        return m_Lexer;
+    }
+
+    // Runs only the tokenizer over 'text' and returns the number of
+    // tokens, the end of the text not counted. A bad character throws as
+    // in Parse().
+    size_t Tokenize(const char* text)
+    {
+        return Tokenize(text, (size_t)-1);
+    }
+
+    size_t Tokenize(const char* text, size_t length)
+    {
+        if(!Scan(text, length))
+            Throw();
+
+        size_t count = 0;
+        for(;;) {
+            if(!GetNextToken())
+                Throw();
+            if(m_crtToken.Type == EndOfText)
+                return count;
+            count++;
+        }
+    }
+
+    // Trees from an arena-backed parser are freed by resetting or releasing
+    // the arena, e.g. 'arena.Reset()' before the next Parse() call.
+    Node Parse(const char* text)
+    {
+        return Parse(text, (size_t)-1);
+    }
+
+    // Parses the 'length' characters at 'text', which need not be followed
+    // by a NUL, e.g. one line of a memory-mapped file; a NUL within them
+    // still ends the expression. Nothing is copied, and the text is only
+    // read during the call.
+    Node Parse(const char* text, size_t length)
+    {
+        Node node = Parse(text, length, m_Error);
+        if(m_Error.Code != ErrorInfo::None)
+            Throw();
 
-        return Expression();
+        return node;
+    }
+
+    // The same without exceptions: on an error, fills in 'error' and
+    // returns Node() (NULL for the tree), having discarded what was built.
+    // Nothing is allocated or formatted for the error itself.
+    Node Parse(const char* text, ErrorInfo& error)
+    {
+        return Parse(text, (size_t)-1, error);
+    }
+
+    Node Parse(const char* text, size_t length, ErrorInfo& error)
+    {
+        m_Builder.Begin();
+
+        Node node = Node();
+        if(!Scan(text, length) || !GetNextToken() || !Expression(node)) {
+            for(size_t i = 0; i < m_Operands.size(); i++)
+                m_Builder.Discard(m_Operands[i]);
+            m_Operands.clear();
+        }
+
+        error = m_Error;
+        return node;
+    }
+
+    // Parse() for a text that must be the expression and nothing else:
+    // what Parse() ignores after it, e.g. the '2' in '1 2', is an
+    // 'Unexpected token' error where it starts, and every '(' needs a ')'
+    // of its own (see Match()).
+    Node ParseStrict(const char* text, ErrorInfo& error)
+    {
+        return ParseStrict(text, (size_t)-1, error);
+    }
+
+    Node ParseStrict(const char* text, size_t length, ErrorInfo& error)
+    {
+        // Note: A builder may throw, e.g. std::bad_alloc, and the next
+        //       Parse() must not be strict.
+        m_Strict = true;
+        Node node = Node();
+        try
+        {
+            node = Parse(text, length, error);
+        }
+        catch(...)
+        {
+            m_Strict = false;
+            throw;
+        }
+        m_Strict = false;
+
+        if(error.Code == ErrorInfo::None && m_crtToken.Type != EndOfText) {
+            m_Builder.Discard(node);
+            node = Node();
+
+            // The current token is m_Next - 1; the expression ended before.
+            m_Index = m_Lexer.Tokens()[m_Next - 2].End;
+            while(isspace((unsigned char)At(m_Index)))
+                m_Index++;
+            Fail(ErrorInfo::UnexpectedToken, At(m_Index));
+            error = m_Error;
+        }
+
+        return node;
     }
 };
+
+typedef BasicParser<TreeBuilder> Parser;
@@ -0,0 +1,212 @@
+/*
+ * Postfix.h - A linear, index-based representation of the AST.
+ *
+ * Note: Instead of a tree of 32-byte nodes linked by pointers, the
+ *       expression is kept as one contiguous array of small nodes, in which
+ *       the children are referred to by their index in the array and the
+ *       numbers live in a separate constant pool:
+ *
+ *       For example, '1+2*3' becomes,
+ *
+ *        index   Op      Left  Right          Constants
+ *        ---------------------------          ---------
+ *         0      NUM     0                     0: 1
+ *         1      NUM     1                     1: 2
+ *         2      NUM     2                     2: 3
+ *         3      *       1     2
+ *         4      +       0     3
+ *
+ *       The parser emits the nodes children first, so every node only ever
+ *       refers to nodes before it and the root is the last one. Evaluation
+ *       is then one pass from front to back, without recursion, and the
+ *       whole expression can be copied with memcpy.
+ */
+
+#ifndef POSTFIX_H
+#  define POSTFIX_H 1
+#endif
+
+#include <vector>
+#include <stdint.h>
+
+#ifndef PARSER_H
+#  include "Parser.h"
+#endif
+
+// Op is an ASTNodeType. For NumberValue, Left is the index into the
+// constant pool; for Variable, it is the slot; for UnaryMinus, only Left
+// is used.
+struct PostfixNode {
+    uint8_t     Op;
+    uint32_t    Left;
+    uint32_t    Right;
+};
+
+class PostfixExpression
+{
+public:
+    std::vector<PostfixNode> Nodes;
+    std::vector<double>      Constants;
+
+    void Clear()
+    {
+        Nodes.clear();
+        Constants.clear();
+    }
+
+    bool Empty() const
+    {
+        return Nodes.empty();
+    }
+
+    uint32_t Root() const
+    {
+        return (uint32_t)Nodes.size() - 1;
+    }
+};
+
+// PostfixBuilder - lets the parser append straight to a PostfixExpression.
+class PostfixBuilder
+{
+    PostfixExpression* m_Expr;
+
+    uint32_t Append(ASTNodeType op, uint32_t left, uint32_t right)
+    {
+        PostfixNode node;
+        node.Op = (uint8_t)op;
+        node.Left = left;
+        node.Right = right;
+        m_Expr->Nodes.push_back(node);
+
+        return (uint32_t)m_Expr->Nodes.size() - 1;
+    }
+
+public:
+    typedef uint32_t Node;
+
+    PostfixBuilder(PostfixExpression* expr = NULL):
+        m_Expr(expr)
+    {
+    }
+
+    void Begin()
+    {
+        m_Expr->Clear();
+    }
+
+    // Note: After a failed parse, the nodes stay in the expression until
+    //       the next Begin().
+    void Discard(Node)
+    {
+    }
+
+    Node Binary(ASTNodeType type, Node left, Node right)
+    {
+        return Append(type, left, right);
+    }
+
+    Node Unary(Node left)
+    {
+        return Append(UnaryMinus, left, 0);
+    }
+
+    Node Number(double value)
+    {
+        m_Expr->Constants.push_back(value);
+
+        return Append(NumberValue, (uint32_t)m_Expr->Constants.size() - 1, 0);
+    }
+
+    Node Variable(unsigned slot)
+    {
+        return Append(::Variable, slot, 0);
+    }
+};
+
+// Usage: 'PostfixParser parser(&expr); parser.Parse(text);' fills 'expr'
+//        and returns the index of its root.
+typedef BasicParser<PostfixBuilder> PostfixParser;
+
+// Hands an existing tree to 'builder' as the parser would have, left
+// operands first, and stores the node of its root in 'root', if given.
+// Returns false if the tree is malformed.
+// Note: The traversal keeps its own stack, so the depth of the tree does
+//       not matter.
+template<class Builder>
+bool Flatten(ASTNode* ast, Builder& builder, typename Builder::Node* root = NULL)
+{
+    struct Frame {
+        ASTNode* Node;
+        bool     Expanded;
+    };
+
+    builder.Begin();
+
+    std::vector<Frame> stack;
+    std::vector<typename Builder::Node> results;
+
+    Frame top = { ast, false };
+    stack.push_back(top);
+
+    while(!stack.empty()) {
+        Frame frame = stack.back();
+        stack.pop_back();
+
+        ASTNode* node = frame.Node;
+        if(node == NULL)
+            return false;
+
+        switch(node->Type) {
+        case NumberValue:
+            results.push_back(builder.Number(node->Value));
+            break;
+
+        case Variable:
+            results.push_back(builder.Variable(node->Slot));
+            break;
+
+        case UnaryMinus:
+            if(!frame.Expanded) {
+                Frame self = { node, true }, left = { node->Left, false };
+                stack.push_back(self);
+                stack.push_back(left);
+            }
+            else
+                results.back() = builder.Unary(results.back());
+            break;
+
+        case OperatorPlus:
+        case OperatorMinus:
+        case OperatorMul:
+        case OperatorDiv:
+            if(!frame.Expanded) {
+                Frame self = { node, true }, left = { node->Left, false }, right = { node->Right, false };
+                stack.push_back(self);
+                stack.push_back(right);
+                stack.push_back(left);
+            }
+            else {
+                typename Builder::Node r = results.back();
+                results.pop_back();
+                results.back() = builder.Binary(node->Type, results.back(), r);
+            }
+            break;
+
+        default:
+            return false;
+        }
+    }
+
+    if(root != NULL)
+        *root = results.back();
+
+    return true;
+}
+
+// Converts an existing tree to the postfix form. Returns false, leaving
+// 'expr' incomplete, if the tree is malformed.
+inline bool Flatten(ASTNode* ast, PostfixExpression& expr)
+{
+    PostfixBuilder builder(&expr);
+    return Flatten(ast, builder);
+}
@@ -0,0 +1,87 @@
+/*
+ * Symbols.h - Maps variable names to dense slot indices.
+ *
+ * Note: Names are looked up once, while parsing. The tree only keeps the
+ *       slot index of each variable, and evaluation reads the value from
+ *       'slots[index]', so evaluating a parsed expression for a new set of
+ *       values costs no lookup, no parse and no allocation:
+ *
+ *        SymbolTable symbols;
+ *        Parser parser(NULL, &symbols);
+ *        ASTNode* ast = parser.Parse("x*x + 2*y");
+ *
+ *        double slots[2];
+ *        slots[symbols.Find("x")] = 3;
+ *        slots[symbols.Find("y")] = 4;
+ *        double value = Evaluator().Evaluate(ast, slots);
+ */
+
+#ifndef SYMBOLS_H
+#  define SYMBOLS_H 1
+#endif
+
+#include <map>
+#include <string>
+#include <vector>
+
+class SymbolTable
+{
+    std::map<std::string, unsigned> m_Slots;
+    std::vector<std::string>        m_Names;
+
+public:
+    enum { NotFound = ~0u };
+
+    // Returns the slot of 'name', giving it the next free slot if it is new.
+    unsigned Declare(const std::string& name)
+    {
+        std::map<std::string, unsigned>::iterator it = m_Slots.find(name);
+        if(it != m_Slots.end())
+            return it->second;
+
+        unsigned slot = (unsigned)m_Names.size();
+        m_Slots[name] = slot;
+        m_Names.push_back(name);
+
+        return slot;
+    }
+
+    unsigned Declare(const char* name, size_t length)
+    {
+        return Declare(std::string(name, length));
+    }
+
+    unsigned Find(const std::string& name) const
+    {
+        std::map<std::string, unsigned>::const_iterator it = m_Slots.find(name);
+
+        return it == m_Slots.end() ? (unsigned)NotFound : it->second;
+    }
+
+    const std::string& Name(unsigned slot) const
+    {
+        return m_Names[slot];
+    }
+
+    // The number of slots an evaluation needs.
+    size_t Size() const
+    {
+        return m_Names.size();
+    }
+
+    // Forgets the names declared after the table had 'size' slots, e.g.
+    // those of a formula that failed to parse.
+    void Truncate(size_t size)
+    {
+        while(m_Names.size() > size) {
+            m_Slots.erase(m_Names.back());
+            m_Names.pop_back();
+        }
+    }
+
+    void Clear()
+    {
+        m_Slots.clear();
+        m_Names.clear();
+    }
+};
@@ -0,0 +1,110 @@
+/*
+ * Validator.h - Checks that texts are well-formed expressions, without
+ * building anything.
+ *
+ * Note: The Validator is the parser with a builder that builds nothing, so
+ *       it accepts the same expressions as Parser::ParseStrict() and
+ *       reports the same errors, at the same positions: those of Parse(),
+ *       and also anything after the expression and a '(' that is only
+ *       closed by the ')' before it, as in '((1)'.
+ *
+ *        Validator validator;
+ *        ErrorInfo error;
+ *
+ *        if(!validator.Validate("1 + 2)", error))
+ *            ... error.Position is 5, error.Message() says why
+ *
+ *       The numbers are not converted, no exception is thrown and, once the
+ *       lexer's token array has grown to the longest text, nothing is
+ *       allocated. With a symbol table, names are accepted, as Parse()
+ *       would accept them, but not declared: the table is only a switch
+ *       and is left as it is.
+ */
+
+#ifndef VALIDATOR_H
+#  define VALIDATOR_H 1
+#endif
+
+#ifndef PARSER_H
+#  include "Parser.h"
+#endif
+
+// NullBuilder - the builder for syntax checks only.
+class NullBuilder
+{
+public:
+    struct Node {
+    };
+
+    void Begin()
+    {
+    }
+
+    void Discard(Node)
+    {
+    }
+
+    Node Binary(ASTNodeType, Node, Node)
+    {
+        return Node();
+    }
+
+    Node Unary(Node)
+    {
+        return Node();
+    }
+
+    Node Number(double)
+    {
+        return Node();
+    }
+
+    Node Variable(unsigned)
+    {
+        return Node();
+    }
+};
+
+class Validator
+{
+    BasicParser<NullBuilder> m_Parser;
+
+public:
+    Validator(SymbolTable* symbols = NULL):
+        m_Parser(NullBuilder())
+    {
+        m_Parser.SetNames(symbols != NULL);
+        m_Parser.GetLexer().SetValues(false);
+    }
+
+    // E.g. for SetMaxDepth(), which applies as in Parse().
+    BasicParser<NullBuilder>& GetParser()
+    {
+        return m_Parser;
+    }
+
+    bool Validate(const char* text, ErrorInfo& error)
+    {
+        return Validate(text, (size_t)-1, error);
+    }
+
+    bool Validate(const char* text, size_t length, ErrorInfo& error)
+    {
+        m_Parser.ParseStrict(text, length, error);
+
+        return error.Code == ErrorInfo::None;
+    }
+
+    // Validates 'count' NUL-terminated texts, with one ErrorInfo each in
+    // 'errors'; returns the number of malformed ones.
+    size_t ValidateBatch(const char* const* texts, size_t count, ErrorInfo* errors)
+    {
+        size_t malformed = 0;
+
+        for(size_t i = 0; i < count; i++)
+            if(!Validate(texts[i], (size_t)-1, errors[i]))
+                malformed++;
+
+        return malformed;
+    }
+};
@@ -0,0 +1,155 @@
+/*
+ * ValueParser.h - Evaluates an expression while parsing it, without a tree.
+ *
+ * Note: For an expression that is evaluated once, building the tree, walking
+ *       it and freeing it is all overhead. The parser hands each operator
+ *       to its builder only after both operands are done, in exactly the
+ *       order in which the Evaluator would compute them, so a builder whose
+ *       nodes are the values computes the same double:
+ *
+ *        ValueParser parser;
+ *        double value = parser.Evaluate("1+2*3");      (7)
+ *
+ *       The errors are those of Parser followed by Evaluator, too: a
+ *       ParserException for any syntax error, and only then, for a text
+ *       with variables but no values for them, the EvaluatorException
+ *       "No values given for the variables!".
+ */
+
+#ifndef VALUEPARSER_H
+#  define VALUEPARSER_H 1
+#endif
+
+#ifndef PARSER_H
+#  include "Parser.h"
+#endif
+
+#ifndef EVALUATOR_H
+#  include "Evaluator.h"
+#endif
+
+// ValueBuilder - the builder whose nodes are values.
+class ValueBuilder
+{
+    const double* m_Slots;
+    bool          m_NoSlots;    // a variable was read without values
+
+public:
+    typedef double Node;
+
+    ValueBuilder():
+        m_Slots(NULL), m_NoSlots(false)
+    {
+    }
+
+    void SetSlots(const double* slots)
+    {
+        m_Slots = slots;
+    }
+
+    bool NoSlots() const
+    {
+        return m_NoSlots;
+    }
+
+    void Begin()
+    {
+        m_NoSlots = false;
+    }
+
+    void Discard(Node)
+    {
+    }
+
+    Node Binary(ASTNodeType type, Node left, Node right)
+    {
+        switch(type) {
+        case OperatorPlus:  return left + right;
+        case OperatorMinus: return left - right;
+        case OperatorMul:   return left * right;
+        default:            return left / right;
+        }
+    }
+
+    Node Unary(Node left)
+    {
+        return -left;
+    }
+
+    Node Number(double value)
+    {
+        return value;
+    }
+
+    // Note: The error has to wait for the end of the parse, since a syntax
+    //       error later on comes first.
+    Node Variable(unsigned slot)
+    {
+        if(m_Slots == NULL) {
+            m_NoSlots = true;
+            return 0;
+        }
+
+        return m_Slots[slot];
+    }
+};
+
+class ValueParser
+{
+    BasicParser<ValueBuilder> m_Parser;
+
+public:
+    // With a symbol table, variables are resolved through it as in Parser,
+    // and their values come from 'slots'.
+    ValueParser(SymbolTable* symbols = NULL):
+        m_Parser(ValueBuilder(), symbols)
+    {
+    }
+
+    // E.g. for SetMaxDepth(), which applies as in Parse().
+    BasicParser<ValueBuilder>& GetParser()
+    {
+        return m_Parser;
+    }
+
+    double Evaluate(const char* text, const double* slots = NULL)
+    {
+        return Evaluate(text, (size_t)-1, slots);
+    }
+
+    double Evaluate(const char* text, size_t length, const double* slots = NULL)
+    {
+        m_Parser.GetBuilder().SetSlots(slots);
+        double value = m_Parser.Parse(text, length);
+
+        if(m_Parser.GetBuilder().NoSlots())
+            throw EvaluatorException("No values given for the variables!");
+
+        return value;
+    }
+
+    // Without exceptions for syntax errors: returns 0 and fills in 'error'.
+    double Evaluate(const char* text, size_t length, const double* slots, ErrorInfo& error)
+    {
+        m_Parser.GetBuilder().SetSlots(slots);
+        double value = m_Parser.Parse(text, length, error);
+
+        if(error.Code == ErrorInfo::None && m_Parser.GetBuilder().NoSlots())
+            throw EvaluatorException("No values given for the variables!");
+
+        return value;
+    }
+
+    // The same with BasicParser::ParseStrict(): the text must be the
+    // expression and nothing else.
+    double EvaluateStrict(const char* text, size_t length, const double* slots, ErrorInfo& error)
+    {
+        m_Parser.GetBuilder().SetSlots(slots);
+        double value = m_Parser.ParseStrict(text, length, error);
+
+        if(error.Code == ErrorInfo::None && m_Parser.GetBuilder().NoSlots())
+            throw EvaluatorException("No values given for the variables!");
+
+        return value;
+    }
+};
@@ -5,6 +5,8 @@
 #  define AST_H
 #endif
 
+#include <stddef.h>
+
 #define MAX_LEN  256
 
 #define EOT      257
@@ -25,6 +27,9 @@
 #define U_MIN    271
 #define NUM_VAL  272
 
+/* Nodes per arena block */
+#define BLOCK_NODES 1024
+
 struct token {
     int    type;
     double value;
@@ -38,3 +43,46 @@ struct Astnode {
     Astnode *left;
     Astnode *right;
 };
+
+/* The nodes live in a list of blocks owned by the context, so a whole tree
+ * is released at once, with evalexp_reset(), instead of node by node.
+ */
+typedef struct Astblock Astblock;
+struct Astblock {
+    Astblock *next;
+    size_t   used;
+    Astnode  nodes[BLOCK_NODES];
+};
+
+/* Everything one parse needs. Each thread uses its own context; nothing
+ * is shared between contexts, so any number of them can be used at once.
+ */
+typedef struct evalexp_ctx evalexp_ctx;
+struct evalexp_ctx {
+    struct token token;
+    const char   *text;
+    int          index;
+    int          error;             /* non-zero after an error */
+    int          error_pos;
+    char         message[MAX_LEN];
+    Astblock     *blocks;           /* all blocks, in order */
+    Astblock     *current;          /* the block being filled */
+    size_t       allocations;       /* blocks obtained from malloc */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void    evalexp_init(evalexp_ctx *);
+void    evalexp_reset(evalexp_ctx *);
+void    evalexp_destroy(evalexp_ctx *);
+Astnode *evalexp_parse(evalexp_ctx *, const char *);
+int     evalexp_tokenize(evalexp_ctx *, const char *);
+int     evalexp_validate(const char *);
+size_t  evalexp_validate_batch(const char *const *, size_t, int *);
+double  evalexp_eval(evalexp_ctx *, Astnode *);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,121 @@
+/*
+ * bench.c - Parse and evaluate throughput, with one context per thread.
+ *
+ * Build: cc -O2 -DEVALEXP_NO_MAIN -o bench bench.c evalexp.c -lpthread
+ * Usage: bench [iterations per thread] [max threads]
+ *
+ * Note: Every thread parses and evaluates the same set of expressions over
+ *       and over again, each with its own evalexp_ctx, and releases the
+ *       trees with evalexp_reset() after every expression. The threads
+ *       share nothing, so the total throughput should grow with the number
+ *       of threads up to the number of cores.
+ */
+#include "ast.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+static const char *cases[] = {
+    "1+2+3+4",
+    "1*2*3*4",
+    "1-2-3-4",
+    "1/2/3/4",
+    "1*2+3*4",
+    "1+2*3+4",
+    "(1+2)*(3+4)",
+    "1+(2*3)*(4+5)",
+    "1+(2*3)/4+5",
+    "5/(4+3)/2",
+    "1 + 2.5",
+    "125",
+    "-1",
+    "-1+(-2)",
+    "-1+(-2.0)"
+};
+#define CASES ((int)(sizeof(cases) / sizeof(cases[0])))
+
+struct job {
+    pthread_t thread;
+    long      iterations;
+    double    sum;
+    int       errors;
+    size_t    allocations;
+};
+
+static void *run(void *arg)
+{
+    struct job *job = (struct job *)arg;
+    evalexp_ctx ctx;
+    long i;
+    int k;
+
+    evalexp_init(&ctx);
+
+    for (i = 0; i < job->iterations; i++) {
+        for (k = 0; k < CASES; k++) {
+            Astnode *ast = evalexp_parse(&ctx, cases[k]);
+            if (!ctx.error)
+                job->sum += evalexp_eval(&ctx, ast);
+            if (ctx.error)
+                job->errors++;
+            evalexp_reset(&ctx);
+        }
+    }
+
+    job->allocations = ctx.allocations;
+    evalexp_destroy(&ctx);
+
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 100000;
+    int  max_threads = argc > 2 ? atoi(argv[2]) : 8;
+    double base = 0;
+    int threads;
+
+    printf("%8s %14s %12s %9s %7s\n",
+           "threads", "expressions/s", "ns/expr", "speedup", "blocks");
+
+    for (threads = 1; threads <= max_threads; threads *= 2) {
+        struct job *jobs = (struct job *)calloc(threads, sizeof(struct job));
+        double start, seconds, rate;
+        size_t blocks = 0;
+        int errors = 0;
+        int t;
+
+        start = now();
+        for (t = 0; t < threads; t++) {
+            jobs[t].iterations = iterations;
+            pthread_create(&jobs[t].thread, NULL, run, &jobs[t]);
+        }
+        for (t = 0; t < threads; t++) {
+            pthread_join(jobs[t].thread, NULL);
+            errors += jobs[t].errors;
+            blocks += jobs[t].allocations;
+        }
+        seconds = now() - start;
+
+        rate = (double)threads * iterations * CASES / seconds;
+        if (threads == 1)
+            base = rate;
+
+        printf("%8d %14.0f %12.1f %8.2fx %7lu%s\n", threads, rate,
+               1e9 * threads / rate, rate / base, (unsigned long)blocks,
+               errors ? "  ERRORS" : "");
+
+        free(jobs);
+    }
+
+    return 0;
+}
@@ -1,32 +1,56 @@
 /*
- * evalexp.c - 
+ * evalexp.c -
+ *
+ * Note: All the state of a parse lives in an evalexp_ctx, and nothing else
+ *       is static, so each thread can parse and evaluate with its own
+ *       context without any locking:
+ *
+ *        evalexp_ctx ctx;
+ *        evalexp_init(&ctx);
+ *
+ *        ast = evalexp_parse(&ctx, "1+2*3");
+ *        if (!ctx.error)
+ *            value = evalexp_eval(&ctx, ast);
+ *        evalexp_reset(&ctx);     (releases every tree parsed so far)
+ *
+ *        evalexp_destroy(&ctx);
+ *
+ *       The nodes come from blocks owned by the context. They are never
+ *       freed one by one: evalexp_reset() hands them all back at once and
+ *       keeps the blocks for the next parse, evalexp_destroy() frees them.
+ *
+ *       evalexp_validate() only checks the syntax; it needs no context.
+ *
+ *       Build with -DEVALEXP_NO_MAIN to use this file as a library.
  */
 #include "ast.h"
+#include "fastfloat.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-/* Yeah, yeah, I know; I know .... */
-static struct token g_token;
-static const char *g_text;
-static int g_index;
-static int g_error;
+#include <ctype.h>
+#include <stdarg.h>
 
 /* prototypes */
-void    test(const char *);
-Astnode *parse(const char *);
-double  evaluate(Astnode *);
-void    next_token();
-double  get_number();
-void    match(char *);
-Astnode *create_node(int, Astnode *, Astnode *);
-Astnode *create_unarynode(Astnode *);
-Astnode *create_numbernode(double);
-Astnode *expression();
-Astnode *expression1();
-Astnode *term();
-Astnode *term1();
-Astnode *factor();
+static void    fail(evalexp_ctx *, const char *, ...);
+static double  evaluate(evalexp_ctx *, Astnode *);
+static void    next_token(evalexp_ctx *);
+static double  get_number(evalexp_ctx *);
+static void    match(evalexp_ctx *, const char *);
+static Astnode *new_node(evalexp_ctx *);
+static Astnode *create_node(evalexp_ctx *, int, Astnode *, Astnode *);
+static Astnode *create_unarynode(evalexp_ctx *, Astnode *);
+static Astnode *create_numbernode(evalexp_ctx *, double);
+static Astnode *expression(evalexp_ctx *);
+static Astnode *expression1(evalexp_ctx *);
+static Astnode *term(evalexp_ctx *);
+static Astnode *term1(evalexp_ctx *);
+static Astnode *factor(evalexp_ctx *);
+static size_t  skip_number(const char *);
+
+#ifndef EVALEXP_NO_MAIN
+static void test(const char *);
+static void test_validate(const char *, int);
 
 int main(int argc, char *argv[])
 {
@@ -53,53 +77,239 @@ int main(int argc, char *argv[])
     test("1 ** 2.5");
     test("*1 / 2.5");
 
+    test_validate("(1+2)*-3", -1);
+    test_validate("1 2", 2);
+    test_validate("1+2)", 3);
+    test_validate("((1)", 4);
+    test_validate("(1+2", 4);
+    test_validate("1+", 2);
+    test_validate("", 0);
+    test_validate("1 + 2&5", 5);
+    test_validate("1 ** 2", 4);
+
     return 0;
 }
 
-void test(const char *text)
+static void test(const char *text)
 {
     double value;
     Astnode *ast;
+    evalexp_ctx ctx;
 
-    /* Note: Ok, I'll admit it: This is rather poor programming practice.
-     *       But, in-the-end, this is just a simple program, designed,
-     *       primarily, as a benchmark implementation with which to
-     *       test the Winxed implementation, where I will use try/catch
-     *       blocks and exceptions.
-     */
-    g_error = 0; 
+    evalexp_init(&ctx);
 
-    ast = parse(text);
-    value = evaluate(ast);
-    if (!g_error)
+    ast = evalexp_parse(&ctx, text);
+    if (!ctx.error)
+        value = evalexp_eval(&ctx, ast);
+
+    if (!ctx.error)
         printf("%s\t%g\n", text, value);
+    else
+        fprintf(stderr, "%s\n", ctx.message);
+
+    evalexp_destroy(&ctx);
+    return;
+}
+
+/* evalexp_validate() has to give 'expected', and where evalexp_parse()
+ * fails too, its position.
+ */
+static void test_validate(const char *text, int expected)
+{
+    int position = evalexp_validate(text);
+    int same = position == expected;
+    evalexp_ctx ctx;
+
+    evalexp_init(&ctx);
+    evalexp_parse(&ctx, text);
+    if (ctx.error)
+        same = same && ctx.error_pos == position;
+    evalexp_destroy(&ctx);
+
+    printf("%s\t%d%s\n", text, position, same ? "" : " (FAILED)");
+    return;
+}
+#endif
+
+void evalexp_init(evalexp_ctx *ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void evalexp_reset(evalexp_ctx *ctx)
+{
+    /* Note: The blocks are kept; new_node() empties each one again when
+     *       it gets to it.
+     */
+    ctx->current = NULL;
+    return;
+}
+
+void evalexp_destroy(evalexp_ctx *ctx)
+{
+    Astblock *block = ctx->blocks;
 
-    free(ast); /* Note: Were I doing this for something other than a simple,
-                *       benchmark implementation, I would take much more
-                *       care with the allocation and destruction of resources.
-                */
+    while (block != NULL) {
+        Astblock *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    ctx->blocks  = NULL;
+    ctx->current = NULL;
     return;
 }
 
-Astnode *parse(const char *text)
+Astnode *evalexp_parse(evalexp_ctx *ctx, const char *text)
+{
+    Astnode *ast;
+
+    ctx->text       = text;
+    ctx->index      = 0;
+    ctx->error      = 0;
+    ctx->error_pos  = 0;
+    ctx->message[0] = 0;
+
+    next_token(ctx);
+
+    ast = expression(ctx);
+
+    return ctx->error ? NULL : ast;
+}
+
+/* Runs only the tokenizer; returns the number of tokens, or -1 on error. */
+int evalexp_tokenize(evalexp_ctx *ctx, const char *text)
+{
+    int count = 0;
+
+    ctx->text       = text;
+    ctx->index      = 0;
+    ctx->error      = 0;
+    ctx->error_pos  = 0;
+    ctx->message[0] = 0;
+
+    for (next_token(ctx); ctx->token.type != EOT; next_token(ctx)) {
+        if (ctx->error)
+            return -1;
+        count++;
+    }
+
+    return count;
+}
+
+/* Checks that 'text' is one well-formed expression and nothing else;
+ * returns -1 if it is, or the position of the first error.
+ *
+ * Note: Nothing is built or allocated. The grammar only needs to know
+ *       whether an operand or an operator comes next, and how many
+ *       parentheses are open, so the text is read once, left to right,
+ *       without recursion. Where evalexp_parse() rejects a text, the
+ *       position is the one it reports. Besides, anything after the
+ *       expression is an error at the position where it starts (the
+ *       parser ignores it), and so is a '(' left open at the end even
+ *       though the text ends with ')', e.g. '((1)', which the parser's
+ *       match() lets through.
+ */
+int evalexp_validate(const char *text)
+{
+    int index = 0, depth = 0, operand = 1;
+
+    for (;;) {
+        unsigned char c;
+
+        while (isspace((unsigned char)text[index])) index++;
+        c = (unsigned char)text[index];
+
+        if (operand) {
+            if (isdigit(c)) {
+                index += (int)skip_number(&text[index]);
+                operand = 0;
+            }
+            else if (c == '(') {
+                depth++;
+                index++;
+            }
+            else if (c == '-')
+                index++;
+            else if (c == '+' || c == '*' || c == '/' || c == ')')
+                return index + 1;       /* after the token, as factor() */
+            else
+                return index;           /* a bad character or the end */
+        }
+        else {
+            if (c == 0)
+                return depth == 0 ? -1 : index;
+            else if (c == '+' || c == '-' || c == '*' || c == '/') {
+                operand = 1;
+                index++;
+            }
+            else if (c == ')' && depth > 0) {
+                depth--;
+                index++;
+            }
+            else if (depth > 0 && c == '(')
+                return index + 1;       /* match() is after the token */
+            else if (depth > 0 && isdigit(c))
+                return index + (int)skip_number(&text[index]);
+            else
+                return index;
+        }
+    }
+}
+
+/* Validates 'count' texts, writing each result to 'positions'; returns the
+ * number of malformed ones.
+ */
+size_t evalexp_validate_batch(const char *const *texts, size_t count, int *positions)
+{
+    size_t i, malformed = 0;
+
+    for (i = 0; i < count; i++) {
+        positions[i] = evalexp_validate(texts[i]);
+        if (positions[i] >= 0)
+            malformed++;
+    }
+
+    return malformed;
+}
+
+double evalexp_eval(evalexp_ctx *ctx, Astnode *ast)
+{
+    if (ast == NULL) {
+        fail(ctx, "Incorrect abstract syntax tree");
+        return 0;
+    }
+
+    return evaluate(ctx, ast);
+}
+
+/* Only the first error is kept; the parse unwinds without reporting more. */
+static void fail(evalexp_ctx *ctx, const char *format, ...)
 {
-    g_text  = text;
-    g_index = 0;
+    va_list args;
+
+    if (ctx->error)
+        return;
 
-    next_token();
+    ctx->error     = 1;
+    ctx->error_pos = ctx->index;
 
-    return expression();
+    va_start(args, format);
+    vsnprintf(ctx->message, sizeof(ctx->message), format, args);
+    va_end(args);
+
+    return;
 }
 
-double evaluate(Astnode *ast)
+static double evaluate(evalexp_ctx *ctx, Astnode *ast)
 {
     if (ast->type == NUM_VAL)
         return ast->value;
     else if (ast->type == U_MIN)
-            return -evaluate(ast->left);
+            return -evaluate(ctx, ast->left);
     else {
-        double v1 = evaluate(ast->left);
-        double v2 = evaluate(ast->right);
+        double v1 = evaluate(ctx, ast->left);
+        double v2 = evaluate(ctx, ast->right);
         switch (ast->type) {
         case OP_ADD: return v1 + v2;
         case OP_SUB: return v1 - v2;
@@ -107,90 +317,149 @@ double evaluate(Astnode *ast)
         case OP_DIV: return v1 / v2;
         }
     }
+
+    fail(ctx, "Incorrect syntax tree!");
+    return 0;
 }
 
-void next_token()
+static void next_token(evalexp_ctx *ctx)
 {
-    while (isspace(g_text[g_index])) g_index++;
+    const char *text = ctx->text;
+
+    while (isspace((unsigned char)text[ctx->index])) ctx->index++;
 
-    g_token.value = 0;
-    g_token.symbol = 0;
+    ctx->token.value = 0;
+    ctx->token.symbol = 0;
 
     /* Test for end of text */
-    if (g_text[g_index] == 0) {
-        g_token.type = EOT;
+    if (text[ctx->index] == 0) {
+        ctx->token.type = EOT;
         return;
     }
 
     /* If current character is a digit, then we're reading a number */
-    if (isdigit(g_text[g_index])) {
-        g_token.type = NUM;
-        g_token.value = get_number();
+    if (isdigit((unsigned char)text[ctx->index])) {
+        ctx->token.type = NUM;
+        ctx->token.value = get_number(ctx);
         return;
     }
 
     /* Setting to error is rather standard fair */
-    g_token.type = ERR;
+    ctx->token.type = ERR;
 
     /* Test if the current character is an operator or a paren */
-    switch (g_text[g_index]) {
-    case '+' : g_token.type = ADD;   break;
-    case '-' : g_token.type = SUB;   break;
-    case '*' : g_token.type = MUL;   break;
-    case '/' : g_token.type = DIV;   break;
-    case '(' : g_token.type = O_PAR; break;
-    case ')' : g_token.type = C_PAR; break;
+    switch (text[ctx->index]) {
+    case '+' : ctx->token.type = ADD;   break;
+    case '-' : ctx->token.type = SUB;   break;
+    case '*' : ctx->token.type = MUL;   break;
+    case '/' : ctx->token.type = DIV;   break;
+    case '(' : ctx->token.type = O_PAR; break;
+    case ')' : ctx->token.type = C_PAR; break;
     }
 
-    if (g_token.type != ERR) {
-        g_token.symbol = g_text[g_index];
-        g_index++;
-    }
-    else {
-        g_error = 1; /* throw error switch */
-        fprintf(stderr, "Unexpected token '%s' at position %d\n",
-                g_text, g_index);
+    if (ctx->token.type != ERR) {
+        ctx->token.symbol = text[ctx->index];
+        ctx->index++;
     }
+    else
+        fail(ctx, "Unexpected token '%c' at position %d",
+             text[ctx->index], ctx->index);
 
     return;
 }
 
-double get_number()
+static double get_number(evalexp_ctx *ctx)
 {
-    while (isspace(g_text[g_index])) g_index++;
+    const char *text = ctx->text;
+    double value = 0;
+    size_t length;
 
-    int index = g_index;
-    while (isdigit(g_text[g_index])) g_index++;
-    if (g_text[g_index] == '.') g_index++;
-    while (isdigit(g_text[g_index])) g_index++;
+    while (isspace((unsigned char)text[ctx->index])) ctx->index++;
 
-    if (g_index - index == 0) {
-        g_error = 1; /* throw error switch */
-        fprintf(stderr, "Unexpected input at %d", g_index - index);
-    }
+    length = evalexp_scan_number(&text[ctx->index], (size_t)-1, &value);
+    if (length == 0)
+        fail(ctx, "Number expected but not found!");
+
+    ctx->index += (int)length;
 
-    char buffer[32] = {0};
-    memcpy(buffer, &g_text[index], g_index - index);
-   
-    return atof(buffer);
+    return value;
 }
 
-void match(char *expected)
+/* The length of the number at 'text', as evalexp_scan_number() reads it,
+ * without converting it.
+ */
+static size_t skip_number(const char *text)
 {
-    if (g_text[g_index-1] == (int)expected[0])
-        next_token();
-    else {
-        g_error = 1; /* throw error switch */
-        fprintf(stderr, "Expected token '%s' at position %d\n",
-                expected, g_index);
+    size_t i = 0, j;
+
+    while (number_is_digit(text[i])) i++;
+    if (text[i] == '.')
+        for (i++; number_is_digit(text[i]); i++)
+            ;
+
+    if (text[i] == 'e' || text[i] == 'E') {
+        j = i + 1;
+        if (text[j] == '+' || text[j] == '-')
+            j++;
+        if (number_is_digit(text[j])) {
+            while (number_is_digit(text[j])) j++;
+            i = j;
+        }
     }
 
+    return i;
+}
+
+static void match(evalexp_ctx *ctx, const char *expected)
+{
+    if (ctx->text[ctx->index-1] == (int)expected[0])
+        next_token(ctx);
+    else
+        fail(ctx, "Expected token '%s' at position %d",
+             expected, ctx->index);
+
     return;
 }
 
-Astnode *create_node(int type, Astnode *left, Astnode *right)
+/* Takes the next node from the current block, moving on to the next block,
+ * or allocating one, when it is full.
+ */
+static Astnode *new_node(evalexp_ctx *ctx)
+{
+    Astblock *block = ctx->current;
+
+    if (block == NULL || block->used == BLOCK_NODES) {
+        Astblock *next = block != NULL ? block->next : ctx->blocks;
+
+        if (next == NULL) {
+            next = (Astblock *)malloc(sizeof(struct Astblock));
+            if (next == NULL) {
+                fail(ctx, "Out of memory");
+                return NULL;
+            }
+            next->next = NULL;
+            ctx->allocations++;
+
+            if (block != NULL)
+                block->next = next;
+            else
+                ctx->blocks = next;
+        }
+
+        next->used = 0;
+        ctx->current = block = next;
+    }
+
+    return &block->nodes[block->used++];
+}
+
+static Astnode *create_node(evalexp_ctx *ctx, int type, Astnode *left, Astnode *right)
 {
-    Astnode *node = (Astnode *)malloc(sizeof(struct Astnode));
+    Astnode *node;
+
+    if (ctx->error || (node = new_node(ctx)) == NULL)
+        return NULL;
+
     node->type  = type;
     node->left  = left;
     node->right = right;
@@ -198,115 +467,122 @@ Astnode *create_node(int type, Astnode *left, Astnode *right)
     return node;
 }
 
-Astnode *create_unarynode(Astnode *left)
+static Astnode *create_unarynode(evalexp_ctx *ctx, Astnode *left)
 {
-    Astnode *node = (Astnode *)malloc(sizeof(struct Astnode));
-    node->type  = U_MIN;
-    node->left  = left;
-    node->right = NULL;
-
-    return node;
+    return create_node(ctx, U_MIN, left, NULL);
 }
 
-Astnode *create_numbernode(double value)
+static Astnode *create_numbernode(evalexp_ctx *ctx, double value)
 {
-    Astnode *node = (Astnode *)malloc(sizeof(struct Astnode));
-    node->type  = NUM_VAL;
-    node->value = value;
-    node->left  = NULL; /* Unnecessary, but .... */
-    node->right = NULL; /*           "           */
+    Astnode *node = create_node(ctx, NUM_VAL, NULL, NULL);
+
+    if (node != NULL)
+        node->value = value;
 
     return node;
 }
 
-Astnode *expression()
+static Astnode *expression(evalexp_ctx *ctx)
 {
-    Astnode *tnode  = term();
-    Astnode *e1node = expression1();
+    Astnode *tnode  = term(ctx);
+    Astnode *e1node = expression1(ctx);
 
-    return create_node(OP_ADD, tnode, e1node);
+    return create_node(ctx, OP_ADD, tnode, e1node);
 }
 
-Astnode *expression1()
+static Astnode *expression1(evalexp_ctx *ctx)
 {
     Astnode *tnode;
     Astnode *e1node;
 
-    switch (g_token.type) {
+    if (ctx->error)
+        return NULL;
+
+    switch (ctx->token.type) {
     case ADD:
-        next_token();
-        tnode  = term();
-        e1node = expression1();
+        next_token(ctx);
+        tnode  = term(ctx);
+        e1node = expression1(ctx);
 
-        return create_node(OP_ADD, e1node, tnode);
+        return create_node(ctx, OP_ADD, e1node, tnode);
     case SUB:
-        next_token();
-        tnode  = term();
-        e1node = expression1();
+        next_token(ctx);
+        tnode  = term(ctx);
+        e1node = expression1(ctx);
 
-        return create_node(OP_SUB, e1node, tnode);
+        return create_node(ctx, OP_SUB, e1node, tnode);
     }
 
-    return create_numbernode(0);
+    return create_numbernode(ctx, 0);
 }
 
-Astnode *term()
+static Astnode *term(evalexp_ctx *ctx)
 {
-    Astnode *fnode  = factor();
-    Astnode *t1node = term1();
+    Astnode *fnode  = factor(ctx);
+    Astnode *t1node = term1(ctx);
 
-    return create_node(OP_MUL, fnode, t1node);
+    return create_node(ctx, OP_MUL, fnode, t1node);
 }
 
-Astnode *term1()
+static Astnode *term1(evalexp_ctx *ctx)
 {
     Astnode *fnode;
     Astnode *t1node;
 
-    switch (g_token.type) {
+    if (ctx->error)
+        return NULL;
+
+    switch (ctx->token.type) {
     case MUL:
-        next_token();
-        fnode  = factor();
-        t1node = term1();
+        next_token(ctx);
+        fnode  = factor(ctx);
+        t1node = term1(ctx);
 
-        return create_node(OP_MUL, t1node, fnode);
+        return create_node(ctx, OP_MUL, t1node, fnode);
     case DIV:
-        next_token();
-        fnode  = factor();
-        t1node = term1();
+        next_token(ctx);
+        fnode  = factor(ctx);
+        t1node = term1(ctx);
 
-        return create_node(OP_DIV, t1node, fnode);
+        return create_node(ctx, OP_DIV, t1node, fnode);
     }
 
-    return create_numbernode(1);
+    return create_numbernode(ctx, 1);
 }
 
-Astnode *factor()
+static Astnode *factor(evalexp_ctx *ctx)
 {
     double  value;
     Astnode *node;
 
-    switch (g_token.type) {
+    if (ctx->error)
+        return NULL;
+
+    switch (ctx->token.type) {
     case O_PAR:
-        next_token();
-        node = expression();
-        match(")");
+        next_token(ctx);
+        node = expression(ctx);
+        match(ctx, ")");
 
         return node;
     case SUB:
-        next_token();
-        node = factor();
+        next_token(ctx);
+        node = factor(ctx);
 
-        return create_unarynode(node);
+        return create_unarynode(ctx, node);
     case NUM:
-        value = g_token.value;
-        next_token();
+        value = ctx->token.value;
+        next_token(ctx);
 
-        return create_numbernode(value);
+        return create_numbernode(ctx, value);
+    case EOT:
+        fail(ctx, "Unexpected end of text at position %d", ctx->index);
+        break;
     default:
-        fprintf(stderr, "Unexpected token '%c' at position %d\n",
-                g_token.symbol, g_index);
-        g_error = 1; /* throw error switch */
+        fail(ctx, "Unexpected token '%c' at position %d",
+             ctx->token.symbol, ctx->index);
         break;
     }
+
+    return NULL;
 }
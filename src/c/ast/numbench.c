@@ -0,0 +1,169 @@
+/*
+ * numbench.c - Number literal conversion: evalexp_scan_number() vs atof().
+ *
+ * Build: cc -O2 -o numbench numbench.c
+ * Usage: numbench [literals per kind] [repeat]
+ *
+ * Note: For each kind of literal, the same random literals (the seed is
+ *       fixed) are converted three ways:
+ *
+ *        atof      copied to a buffer first, as get_number() used to do
+ *        strtod    in place
+ *        scan      evalexp_scan_number(), in place, with the length
+ *
+ *       The fastest of 'repeat' runs counts. 'wrong' are the literals on
+ *       which scan and strtod (which glibc rounds correctly) disagree; it
+ *       should always be 0.
+ */
+#include "fastfloat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum { INTEGER, DECIMAL, LONG, EXPONENT, EXTREME, KINDS };
+
+static const char *kind_names[KINDS] = {
+    "integer",          /* 407 */
+    "decimal",          /* 31.25 */
+    "long",             /* 16 to 31 digits with a point */
+    "exponent",         /* 17 digits and an exponent, as printf("%.17g") */
+    "extreme"           /* 19 to 40 digits, exponents near the limits */
+};
+
+static unsigned long long state = 88172645463325252ull;
+
+static unsigned below(unsigned n)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+
+    return (unsigned)(state % n);
+}
+
+static char *digits(char *p, unsigned count)
+{
+    while (count-- > 0)
+        *p++ = (char)('0' + below(10));
+    return p;
+}
+
+/* One literal at p, NUL terminated; returns its length. */
+static size_t literal(int kind, char *p)
+{
+    char *start = p;
+    unsigned n;
+
+    switch (kind) {
+    case INTEGER:
+        p = digits(p, 1 + below(5));
+        break;
+    case DECIMAL:
+        p = digits(p, 1 + below(4));
+        *p++ = '.';
+        p = digits(p, 1 + below(4));
+        break;
+    case LONG:
+        n = 16 + below(16);
+        p = digits(p, 1 + below(n - 1));
+        *p++ = '.';
+        p = digits(p, n - (unsigned)(p - start - 1));
+        break;
+    case EXPONENT:
+        *p++ = (char)('1' + below(9));
+        *p++ = '.';
+        p = digits(p, 16);
+        p += sprintf(p, "e%s%u", below(2) ? "-" : "", below(300));
+        break;
+    default:
+        p = digits(p, 19 + below(22));
+        p += sprintf(p, "e%s%u", below(2) ? "-" : "", 270 + below(80));
+        break;
+    }
+
+    *p = 0;
+    return p - start;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    long count = argc > 1 ? atol(argv[1]) : 1000000;
+    int repeat = argc > 2 ? atoi(argv[2]) : 5;
+    char *text = (char *)malloc((size_t)count * 64);
+    size_t *offsets = (size_t *)malloc((size_t)count * sizeof(size_t));
+    size_t *lengths = (size_t *)malloc((size_t)count * sizeof(size_t));
+    int kind;
+
+    printf("%-9s %9s %9s %9s %9s %6s\n",
+           "kind", "atof ns", "strtod ns", "scan ns", "speedup", "wrong");
+
+    for (kind = 0; kind < KINDS; kind++) {
+        double best[3] = {0, 0, 0}, sums[3] = {0, 0, 0};
+        size_t used = 0;
+        long i, wrong = 0;
+        int r, method;
+
+        for (i = 0; i < count; i++) {
+            offsets[i] = used;
+            lengths[i] = literal(kind, text + used);
+            used += lengths[i] + 1;
+        }
+
+        for (r = 0; r < repeat; r++) {
+            for (method = 0; method < 3; method++) {
+                double start = now(), sum = 0, seconds;
+
+                for (i = 0; i < count; i++) {
+                    const char *p = text + offsets[i];
+                    double value;
+
+                    if (method == 0) {
+                        char buffer[64] = {0};
+                        memcpy(buffer, p, lengths[i]);
+                        value = atof(buffer);
+                    }
+                    else if (method == 1)
+                        value = strtod(p, NULL);
+                    else
+                        evalexp_scan_number(p, lengths[i], &value);
+
+                    sum += value;
+                }
+
+                seconds = now() - start;
+                if (r == 0 || seconds < best[method])
+                    best[method] = seconds;
+                sums[method] = sum;
+            }
+        }
+
+        for (i = 0; i < count; i++) {
+            const char *p = text + offsets[i];
+            double a = strtod(p, NULL), b;
+
+            evalexp_scan_number(p, lengths[i], &b);
+            if (memcmp(&a, &b, sizeof(double)) != 0)
+                wrong++;
+        }
+
+        printf("%-9s %9.1f %9.1f %9.1f %8.2fx %6ld%s\n", kind_names[kind],
+               1e9 * best[0] / count, 1e9 * best[1] / count,
+               1e9 * best[2] / count, best[0] / best[2], wrong,
+               sums[0] == sums[2] ? "" : "  (sums differ)");
+    }
+
+    free(text);
+    free(offsets);
+    free(lengths);
+
+    return 0;
+}